@@ -0,0 +1,164 @@
+#include "AssetPack.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+    const char Magic[4] = { 'W', 'P', 'A', 'K' };
+
+    uint64_t align(const uint64_t offset)
+    {
+        return (offset + AssetPackAlignment - 1) & ~static_cast<uint64_t>(AssetPackAlignment - 1);
+    }
+
+    // Bytes an asset of a type and size must have.
+    uint64_t asset_size(const AssetType type, const uint32_t w, const uint32_t h)
+    {
+        switch (type)
+        {
+          case AssetTexture: return static_cast<uint64_t>(w) * h * 4;
+          case AssetMap: return static_cast<uint64_t>(w) * h;
+          case AssetPalette: return static_cast<uint64_t>(w) * 4;
+          default: return 0;
+        }
+    }
+}
+
+AssetPack::AssetPack()
+  : m_entries(nullptr)
+  , m_numassets(0)
+{
+}
+
+bool AssetPack::open(const char* filepath)
+{
+    close();
+
+    if (!m_file.open(filepath))
+        return false;
+
+    const uint8_t* base = m_file.data();
+    const uint64_t filesize = m_file.size();
+
+    AssetPackHeader header;
+    bool valid = filesize >= sizeof(header);
+
+    if (valid)
+    {
+        memcpy(&header, base, sizeof(header));
+        valid =
+            memcmp(header.magic, Magic, sizeof(Magic)) == 0 &&
+            header.version == AssetPackVersion &&
+            filesize >= sizeof(header) + static_cast<uint64_t>(header.numassets) * sizeof(AssetEntry);
+    }
+
+    if (valid)
+    {
+        m_entries = reinterpret_cast<const AssetEntry*>(base + sizeof(header));
+        m_numassets = header.numassets;
+
+        // Reject packs whose table points outside of the file or holds empty
+        // assets, once rather than on every lookup.
+        for (uint32_t i = 0; i < m_numassets && valid; ++i)
+        {
+            const AssetEntry& entry = m_entries[i];
+            valid =
+                memchr(entry.name, 0, sizeof(entry.name)) != nullptr &&
+                entry.type <= AssetPalette &&
+                entry.w > 0 &&
+                (entry.h > 0 || entry.type == AssetPalette) &&
+                entry.size == asset_size(static_cast<AssetType>(entry.type), entry.w, entry.h) &&
+                entry.offset <= filesize &&
+                entry.size <= filesize - entry.offset;
+        }
+    }
+
+    if (!valid)
+        close();
+
+    return valid;
+}
+
+void AssetPack::close()
+{
+    m_file.close();
+    m_entries = nullptr;
+    m_numassets = 0;
+}
+
+bool AssetPack::is_open() const
+{
+    return m_file.is_open();
+}
+
+const AssetEntry* AssetPack::find(const char* name, const AssetType type) const
+{
+    for (uint32_t i = 0; i < m_numassets; ++i)
+    {
+        if (m_entries[i].type == static_cast<uint32_t>(type) && strcmp(m_entries[i].name, name) == 0)
+            return &m_entries[i];
+    }
+
+    return nullptr;
+}
+
+const uint8_t* AssetPack::data(const AssetEntry& entry) const
+{
+    return m_file.data() + entry.offset;
+}
+
+bool write_asset_pack(const char* filepath, const vector<PackedAsset>& assets)
+{
+    AssetPackHeader header;
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = AssetPackVersion;
+    header.numassets = static_cast<uint32_t>(assets.size());
+    header.reserved = 0;
+
+    vector<AssetEntry> entries(assets.size());
+    uint64_t offset = align(sizeof(header) + entries.size() * sizeof(AssetEntry));
+
+    for (size_t i = 0; i < assets.size(); ++i)
+    {
+        const PackedAsset& asset = assets[i];
+        if (asset.name.size() > static_cast<size_t>(MaxAssetNameLength) ||
+            asset.data.size() != asset_size(asset.type, asset.w, asset.h))
+            return false;
+
+        AssetEntry& entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        memcpy(entry.name, asset.name.c_str(), asset.name.size());
+        entry.type = asset.type;
+        entry.w = asset.w;
+        entry.h = asset.h;
+        entry.offset = offset;
+        entry.size = asset.data.size();
+
+        offset = align(offset + entry.size);
+    }
+
+    FILE* file = fopen(filepath, "wb");
+    if (file == nullptr)
+        return false;
+
+    bool success =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        (entries.empty() || fwrite(entries.data(), sizeof(AssetEntry), entries.size(), file) == entries.size());
+
+    uint64_t position = sizeof(header) + entries.size() * sizeof(AssetEntry);
+    const uint8_t padding[AssetPackAlignment] = {};
+
+    for (size_t i = 0; i < assets.size() && success; ++i)
+    {
+        const size_t gap = static_cast<size_t>(entries[i].offset - position);
+        success =
+            (gap == 0 || fwrite(padding, gap, 1, file) == 1) &&
+            (assets[i].data.empty() || fwrite(assets[i].data.data(), assets[i].data.size(), 1, file) == 1);
+        position = entries[i].offset + entries[i].size;
+    }
+
+    return fclose(file) == 0 && success;
+}
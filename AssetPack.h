@@ -0,0 +1,86 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//
+// Archive of assets opened with a single mapping and read in place, so that
+// every process on a machine shares its pages. A pack is an AssetPackHeader,
+// a table of numassets AssetEntry, then the data of every asset at a
+// multiple of AssetPackAlignment from the start of the file. Packs are made
+// by WolfiePack.
+//
+// Textures are w x h RGBA texels, top row first, and maps are w x h cells,
+// top row first, neither of them empty. Palettes of w RGBA colors, at least
+// one, are part of the format for palettized textures, which the renderer
+// does not support yet.
+//
+
+enum AssetType
+{
+    AssetTexture,
+    AssetMap,
+    AssetPalette
+};
+
+struct AssetPackHeader
+{
+    char magic[4];          // "WPAK"
+    uint32_t version;
+    uint32_t numassets;
+    uint32_t reserved;
+};
+
+const int MaxAssetNameLength = 47;
+
+struct AssetEntry
+{
+    char name[MaxAssetNameLength + 1];      // path the asset was packed from, with forward slashes, zero terminated
+    uint32_t type;                          // AssetType
+    uint32_t w, h;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+const uint32_t AssetPackVersion = 1;
+
+const size_t AssetPackAlignment = 64;
+
+class AssetPack
+{
+  public:
+    AssetPack();
+
+    // Map a pack, replacing any previous one, and check its table.
+    bool open(const char* filepath);
+
+    void close();
+
+    bool is_open() const;
+
+    // Asset of the given name and type, or null.
+    const AssetEntry* find(const char* name, const AssetType type) const;
+
+    const uint8_t* data(const AssetEntry& entry) const;
+
+  private:
+    MappedFile m_file;
+    const AssetEntry* m_entries;
+    uint32_t m_numassets;
+};
+
+// An asset to pack, with its data in memory.
+struct PackedAsset
+{
+    std::string name;
+    AssetType type;
+    uint32_t w, h;
+    std::vector<uint8_t> data;
+};
+
+bool write_asset_pack(const char* filepath, const std::vector<PackedAsset>& assets);
@@ -0,0 +1,655 @@
+#include "Engine.h"
+#include "RayQuery.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//
+// Microbenchmarks of the inner loops of the engine: ray casting, column
+// fills and collision resolution, plus batched stepping and rendering of
+// many worlds, observations at various sizes and snapshot restores. Every
+// benchmark runs a few times and the fastest run is reported, in nanoseconds
+// per operation.
+//
+
+const int BenchRepetitions = 5;
+
+const int RayCount = 1 << 18;
+const int FillFrames = 20;
+const int UpdateCount = 1 << 20;
+const int BatchFrames = 4;
+const int ObserveFrames = 20;
+const int SnapshotRestores = 1 << 12;
+
+// Updates between two teleports of the player to a random cell.
+const int UpdatesPerWalk = 256;
+
+// Far end of the rays, as in the renderer.
+const float RayLength = 1000.0f;
+
+const uint32_t MapSeed = 12345;
+
+// Consumed so that the compiler cannot discard the work being timed.
+volatile float sink;
+
+Engine engine;
+World world;
+
+struct Random
+{
+    uint32_t state;
+
+    explicit Random(const uint32_t seed)
+      : state(seed)
+    {
+    }
+
+    uint32_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // Uniform in [0, 1).
+    float uniform()
+    {
+        return static_cast<float>(next() >> 8) / 16777216.0f;
+    }
+};
+
+double now_ns()
+{
+    return chrono::duration<double, nano>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Random position inside a random empty cell of the map, clear of
+// the padding around walls that the player cannot enter.
+void random_position(Random* random, float* x, float* y)
+{
+    const float Margin = 2.0f * WallPadding;
+
+    while (true)
+    {
+        const int ix = static_cast<int>(random->next() % world.map.w);
+        const int iy = static_cast<int>(random->next() % world.map.h);
+
+        if (map(world.map, ix, iy) == 0)
+        {
+            *x = ix + Margin + (1.0f - 2.0f * Margin) * random->uniform();
+            *y = iy + Margin + (1.0f - 2.0f * Margin) * random->uniform();
+            return;
+        }
+    }
+}
+
+struct Ray
+{
+    float x0, y0;
+    float x1, y1;
+};
+
+void bench_cast_ray(const char* name)
+{
+    vector<Ray> rays(RayCount);
+
+    Random random(1);
+    for (int i = 0; i < RayCount; ++i)
+    {
+        Ray& ray = rays[i];
+        random_position(&random, &ray.x0, &ray.y0);
+
+        const float a = 2.0f * Pi * random.uniform();
+        ray.x1 = ray.x0 + RayLength * cos(a);
+        ray.y1 = ray.y0 + RayLength * sin(a);
+    }
+
+    double best = 1.0e30;
+    float sum = 0.0f;
+
+    for (int r = 0; r < BenchRepetitions; ++r)
+    {
+        const double start = now_ns();
+
+        for (int i = 0; i < RayCount; ++i)
+        {
+            const Ray& ray = rays[i];
+
+            float hx, hy, u;
+            if (cast_ray(world.map, ray.x0, ray.y0, ray.x1, ray.y1, &hx, &hy, &u))
+                sum += hx + hy + u;
+        }
+
+        best = min(best, now_ns() - start);
+    }
+
+    sink = sum;
+
+    const double ns = best / RayCount;
+    printf("cast_ray  %-24s %9.1f ns/ray %9.2f Mrays/s\n", name, ns, 1.0e3 / ns);
+
+    // Same rays through the batched queries.
+    vector<float> x0(RayCount), y0(RayCount), x1(RayCount), y1(RayCount);
+    for (int i = 0; i < RayCount; ++i)
+    {
+        x0[i] = rays[i].x0;
+        y0[i] = rays[i].y0;
+        x1[i] = rays[i].x1;
+        y1[i] = rays[i].y1;
+    }
+
+    vector<float> distances(RayCount);
+
+    const RayBatch batch = { RayCount, x0.data(), y0.data(), x1.data(), y1.data() };
+    RayHits hits = {};
+    hits.distance = distances.data();
+
+    double batchbest = 1.0e30;
+
+    for (int r = 0; r < BenchRepetitions; ++r)
+    {
+        const double start = now_ns();
+        cast_rays(&engine, world.map, batch, hits);
+        batchbest = min(batchbest, now_ns() - start);
+    }
+
+    sink = distances[0];
+
+    const double batchns = batchbest / RayCount;
+    printf("cast_rays %-24s %9.1f ns/ray %9.2f Mrays/s\n", name, batchns, 1.0e3 / batchns);
+}
+
+// Batched rays and lidar scans from the left and bottom edges of the map,
+// heading out of it. They all start in a border wall and hit at their origin.
+void bench_edge_rays()
+{
+    vector<float> x0(RayCount), y0(RayCount), x1(RayCount), y1(RayCount), a(RayCount);
+
+    Random random(2);
+    for (int i = 0; i < RayCount; ++i)
+    {
+        // Half on x = 0 heading left, half on y = 0 heading down.
+        const bool left = (i & 1) == 0;
+        const float t = random.uniform();
+        a[i] = (left ? 0.5f : 1.0f) * Pi + Pi * (0.05f + 0.9f * random.uniform());
+
+        x0[i] = left ? 0.0f : t * (world.map.w - 1);
+        y0[i] = left ? t * (world.map.h - 1) : 0.0f;
+        x1[i] = x0[i] + RayLength * cos(a[i]);
+        y1[i] = y0[i] + RayLength * sin(a[i]);
+    }
+
+    vector<float> distances(RayCount);
+
+    const RayBatch batch = { RayCount, x0.data(), y0.data(), x1.data(), y1.data() };
+    RayHits hits = {};
+    hits.distance = distances.data();
+
+    double best = 1.0e30;
+
+    for (int r = 0; r < BenchRepetitions; ++r)
+    {
+        const double start = now_ns();
+        cast_rays(&engine, world.map, batch, hits);
+        best = min(best, now_ns() - start);
+    }
+
+    const int LidarBeams = 8;
+    vector<float> scans(static_cast<size_t>(RayCount) * LidarBeams);
+
+    const LidarPoses poses = { RayCount, x0.data(), y0.data(), a.data() };
+    scan_lidar(&engine, world.map, poses, LidarBeams, RayLength, scans.data());
+
+    int misses = 0;
+    for (int i = 0; i < RayCount; ++i)
+        misses += distances[i] != 0.0f ? 1 : 0;
+    for (size_t i = 0; i < scans.size(); ++i)
+        misses += scans[i] != 0.0f ? 1 : 0;
+
+    sink = distances[0] + scans[0];
+
+    const double ns = best / RayCount;
+    printf("cast_rays %-24s %9.1f ns/ray %9.2f Mrays/s\n", "map edges", ns, 1.0e3 / ns);
+
+    if (misses > 0)
+        printf("  %d rays or beams from the map edges did not hit at their origin\n", misses);
+}
+
+template <int Mode>
+double time_fill(const Column* columns, ScreenPixel* pixels)
+{
+    const Texture& tex = engine.textures[0];
+
+    double best = 1.0e30;
+
+    for (int r = 0; r < BenchRepetitions; ++r)
+    {
+        const double start = now_ns();
+
+        for (int f = 0; f < FillFrames; ++f)
+        {
+#ifdef FLIP
+            for (int x = 0; x < ScreenWidth; ++x)
+                fill_wall<Mode>(tex, columns[x], pixels, x);
+#else
+            fill_rows<Mode>(tex, columns, pixels, 0, ScreenHeight);
+#endif
+        }
+
+        best = min(best, now_ns() - start);
+    }
+
+    sink = pixels[0].r;
+
+    return best / FillFrames;
+}
+
+// Fill a screen of walls of the given height in pixels, seen head-on.
+void bench_fill(const int wallheight)
+{
+    const float d = FocalLength * WallHeight / (static_cast<float>(wallheight) / ScreenHeight * FilmHeight);
+
+    ScreenPixel* pixels = new ScreenPixel[ScreenWidth * ScreenHeight];
+    Column* columns = new Column[ScreenWidth];
+
+    const char* ModeNames[3] = { "flat", "nearest", "bilinear" };
+
+    for (int mode = WallFlat; mode <= WallBilinear; ++mode)
+    {
+        int numpixels = 0;
+        for (int x = 0; x < ScreenWidth; ++x)
+        {
+            project_column(engine.textures[0], d, (x + 0.5f) / ScreenWidth, mode == WallBilinear, &columns[x]);
+            numpixels += columns[x].endy - columns[x].starty;
+        }
+
+#ifndef FLIP
+        // Row fills also write sky and floor.
+        numpixels = ScreenWidth * ScreenHeight;
+#endif
+
+        double ns = 0.0;
+        switch (mode)
+        {
+          case WallFlat: ns = time_fill<WallFlat>(columns, pixels); break;
+          case WallNearest: ns = time_fill<WallNearest>(columns, pixels); break;
+          case WallBilinear: ns = time_fill<WallBilinear>(columns, pixels); break;
+        }
+
+        printf(
+            "fill      %-8s height %-9d %9.2f ns/pixel %8.1f ns/column\n",
+            ModeNames[mode], wallheight,
+            ns / max(numpixels, 1), ns / ScreenWidth);
+    }
+
+    delete[] columns;
+    delete[] pixels;
+}
+
+void bench_update(const char* name)
+{
+    const uint32_t Inputs[] =
+    {
+        InputForward,
+        InputForward | InputRun,
+        InputForward | InputLeft,
+        InputForward | InputRight | InputRun,
+        InputBackward,
+        InputLeft | InputStrafe,
+        InputForward | InputRight | InputStrafe | InputRun
+    };
+    const int NumInputs = sizeof(Inputs) / sizeof(Inputs[0]);
+
+    Random random(2);
+
+    vector<Player> starts(UpdateCount / UpdatesPerWalk);
+    for (size_t i = 0; i < starts.size(); ++i)
+    {
+        random_position(&random, &starts[i].x, &starts[i].y);
+        starts[i].a = 2.0f * Pi * random.uniform();
+    }
+
+    // Hold every input for a while, as a player would.
+    vector<uint32_t> inputs(UpdateCount);
+    for (int i = 0; i < UpdateCount; i += 32)
+        fill(inputs.begin() + i, inputs.begin() + i + 32, Inputs[random.next() % NumInputs]);
+
+    const float dt = 1.0f / DefaultTickRate;
+
+    double best = 1.0e30;
+    float sum = 0.0f;
+
+    for (int r = 0; r < BenchRepetitions; ++r)
+    {
+        const double start = now_ns();
+
+        for (int i = 0; i < UpdateCount; ++i)
+        {
+            if (i % UpdatesPerWalk == 0)
+                world.player = starts[i / UpdatesPerWalk];
+
+            update(&world, inputs[i], dt);
+        }
+
+        best = min(best, now_ns() - start);
+        sum += world.player.x + world.player.y;
+    }
+
+    sink = sum;
+
+    printf("update    %-24s %9.1f ns/update\n", name, best / UpdateCount);
+}
+
+// Step and render a number of worlds, all at once and then one at a time.
+// Both sets of worlds go through the same poses.
+void bench_batch(const int numworlds)
+{
+    vector<World*> batchworlds(numworlds);
+    vector<World*> worlds(numworlds);
+    vector<BatchItem> items(numworlds);
+    for (int i = 0; i < numworlds; ++i)
+    {
+        batchworlds[i] = new World();
+        worlds[i] = new World();
+
+        items[i].world = batchworlds[i];
+        items[i].input = i % 2 == 0 ? InputLeft : InputRight;
+        items[i].pixels = new ScreenPixel[ScreenWidth * ScreenHeight];
+    }
+
+    FrameProfile* profile = new FrameProfile();
+
+    double batched = 1.0e30;
+    double separate = 1.0e30;
+
+    for (int r = 0; r < BenchRepetitions; ++r)
+    {
+        double start = now_ns();
+
+        for (int f = 0; f < BatchFrames; ++f)
+        {
+            profile->clear();
+            step_and_render(&engine, items.data(), numworlds, 1, profile);
+        }
+
+        batched = min(batched, now_ns() - start);
+        start = now_ns();
+
+        for (int f = 0; f < BatchFrames; ++f)
+        {
+            for (int i = 0; i < numworlds; ++i)
+            {
+                step(worlds[i], items[i].input, 1);
+                profile->clear();
+                render(&engine, worlds[i], capture_frame_state(worlds[i], 1.0f), items[i].pixels, profile);
+            }
+        }
+
+        separate = min(separate, now_ns() - start);
+    }
+
+    const double frames = static_cast<double>(BatchFrames) * numworlds;
+    printf(
+        "batch     %-4d worlds %9.1f us/frame batched %9.1f us/frame separately\n",
+        numworlds, batched / frames / 1.0e3, separate / frames / 1.0e3);
+
+    delete profile;
+
+    for (int i = 0; i < numworlds; ++i)
+    {
+        delete[] items[i].pixels;
+        delete batchworlds[i];
+        delete worlds[i];
+    }
+}
+
+// Render observations of a turning player on the calling thread.
+void bench_observe(const ObservationDesc& desc)
+{
+    const int pitch = desc.width * observation_pixel_size(desc.format);
+    vector<uint8_t> pixels(pitch * desc.height);
+
+    ObservationBuffers buffers = {};
+    buffers.pixels = pixels.data();
+    buffers.pitch = pitch;
+
+    FrameProfile* profile = new FrameProfile();
+    World* w = new World();
+
+    double best = 1.0e30;
+
+    for (int r = 0; r < BenchRepetitions; ++r)
+    {
+        const double start = now_ns();
+
+        for (int f = 0; f < ObserveFrames; ++f)
+        {
+            step(w, InputLeft, 1);
+            profile->clear();
+            observe(&engine, w, capture_frame_state(w, 1.0f), desc, buffers, profile);
+        }
+
+        best = min(best, now_ns() - start);
+    }
+
+    const char* FormatNames[] = { "bgra8", "gray8", "red8", "green8", "blue8" };
+
+    char name[64];
+    sprintf(name, "%dx%d x%d %s", desc.width, desc.height, desc.supersampling, FormatNames[desc.format]);
+    printf("observe   %-24s %9.1f us/frame\n", name, best / ObserveFrames / 1.0e3);
+
+    delete w;
+    delete profile;
+}
+
+// Restore a world from two snapshots in turn, each with numchanges cells set
+// since the map was loaded, against loading the map again.
+void bench_snapshot(const int size, const int numchanges)
+{
+    Map m;
+    generate_map(size, size, 0.1f, MapSeed, &m);
+
+    World* w = new World();
+    World* reloaded = new World();
+    load_map(w, m);
+
+    Random random(3);
+
+    WorldSnapshot snapshots[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        for (int j = 0; j < numchanges; ++j)
+            setmap(w, 1 + random.next() % (size - 2), 1 + random.next() % (size - 2), random.next() & 1);
+
+        save_snapshot(*w, &snapshots[i]);
+    }
+
+    WorldSnapshot scratch;
+
+    double bestsave = 1.0e30;
+    double bestrestore = 1.0e30;
+    double bestload = 1.0e30;
+
+    for (int r = 0; r < BenchRepetitions; ++r)
+    {
+        double start = now_ns();
+        for (int i = 0; i < SnapshotRestores; ++i)
+            save_snapshot(*w, &scratch);
+        bestsave = min(bestsave, now_ns() - start);
+
+        start = now_ns();
+        for (int i = 0; i < SnapshotRestores; ++i)
+        {
+            restore_snapshot(w, snapshots[i & 1]);
+            w->mapchanges.clear();
+        }
+        bestrestore = min(bestrestore, now_ns() - start);
+
+        start = now_ns();
+        for (int i = 0; i < SnapshotRestores; ++i)
+            load_map(reloaded, m);
+        bestload = min(bestload, now_ns() - start);
+    }
+
+    sink = static_cast<float>(scratch.data.size());
+
+    char name[64];
+    sprintf(name, "%dx%d %d cells", size, size, numchanges);
+    printf("snapshot  %-24s %9.1f ns/save %9.1f ns/restore %9.1f ns/load_map\n",
+        name,
+        bestsave / SnapshotRestores,
+        bestrestore / SnapshotRestores,
+        bestload / SnapshotRestores);
+
+    delete reloaded;
+    delete w;
+}
+
+struct MapConfig
+{
+    int size;
+    float density;
+};
+
+const MapConfig MapConfigs[] =
+{
+    { 16, 0.05f },
+    { 16, 0.30f },
+    { 64, 0.02f },
+    { 64, 0.10f },
+    { 64, 0.30f },
+    { 256, 0.01f },
+    { 256, 0.10f },
+    { 512, 0.005f }
+};
+
+const int FillHeights[] = { 32, 128, 360, 720, 2880 };
+
+const int BatchSizes[] = { 1, 4, 16 };
+
+const int SnapshotMapSizes[] = { 64, 512 };
+const int SnapshotChanges[] = { 0, 16, 256 };
+
+const ObservationDesc ObservationDescs[] =
+{
+    { ScreenWidth, ScreenHeight, 1, ObservationBGRA8, false },
+    { 160, 120, 1, ObservationBGRA8, false },
+    { 160, 120, 2, ObservationBGRA8, false },
+    { 84, 84, 1, ObservationGray8, false },
+    { 84, 84, 2, ObservationGray8, false },
+    { 84, 84, 4, ObservationGray8, false }
+};
+
+bool selected(const int argc, char* argv[], const char* group)
+{
+    if (argc < 2)
+        return true;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], group) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+// Run all benchmarks, or only the groups named on the command line among
+// cast_ray, fill, update, batch, observe and snapshot.
+int main(int argc, char* argv[])
+{
+    init(&engine);
+
+    const Map defaultmap = world.map;
+    const int NumMapConfigs = sizeof(MapConfigs) / sizeof(MapConfigs[0]);
+
+    if (selected(argc, argv, "cast_ray"))
+    {
+        bench_cast_ray("default map");
+        bench_edge_rays();
+
+        for (int i = 0; i < NumMapConfigs; ++i)
+        {
+            const MapConfig& config = MapConfigs[i];
+            generate_map(config.size, config.size, config.density, MapSeed, &world.map);
+
+            char name[64];
+            sprintf(name, "%dx%d density %.3f", config.size, config.size, config.density);
+            bench_cast_ray(name);
+        }
+
+        world.map = defaultmap;
+        printf("\n");
+    }
+
+    if (selected(argc, argv, "fill"))
+    {
+        for (size_t i = 0; i < sizeof(FillHeights) / sizeof(FillHeights[0]); ++i)
+            bench_fill(FillHeights[i]);
+
+        printf("\n");
+    }
+
+    if (selected(argc, argv, "update"))
+    {
+        bench_update("default map");
+
+        for (int i = 0; i < NumMapConfigs; ++i)
+        {
+            const MapConfig& config = MapConfigs[i];
+            if (config.size > 64)
+                continue;
+
+            generate_map(config.size, config.size, config.density, MapSeed, &world.map);
+
+            char name[64];
+            sprintf(name, "%dx%d density %.3f", config.size, config.size, config.density);
+            bench_update(name);
+        }
+
+        world.map = defaultmap;
+        printf("\n");
+    }
+
+    if (selected(argc, argv, "batch"))
+    {
+        engine.pool.start(static_cast<int>(thread::hardware_concurrency()));
+
+        for (size_t i = 0; i < sizeof(BatchSizes) / sizeof(BatchSizes[0]); ++i)
+            bench_batch(BatchSizes[i]);
+
+        engine.pool.stop();
+        printf("\n");
+    }
+
+    if (selected(argc, argv, "observe"))
+    {
+        for (size_t i = 0; i < sizeof(ObservationDescs) / sizeof(ObservationDescs[0]); ++i)
+            bench_observe(ObservationDescs[i]);
+
+        printf("\n");
+    }
+
+    if (selected(argc, argv, "snapshot"))
+    {
+        for (size_t i = 0; i < sizeof(SnapshotMapSizes) / sizeof(SnapshotMapSizes[0]); ++i)
+        {
+            for (size_t j = 0; j < sizeof(SnapshotChanges) / sizeof(SnapshotChanges[0]); ++j)
+                bench_snapshot(SnapshotMapSizes[i], SnapshotChanges[j]);
+        }
+
+        printf("\n");
+    }
+
+    done(&engine);
+
+    return 0;
+}
@@ -0,0 +1,1810 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "Engine.h"
+#include "TextureCache.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+ScreenPixel rgb(uint8_t r, uint8_t g, uint8_t b)
+{
+    return { b, g, r, 255 };
+}
+
+void setpix(ScreenPixel* pixels, const int x, const int y, const ScreenPixel& color)
+{
+#ifdef FLIP
+    pixels[x * ScreenHeight + y] = color;
+#else
+    pixels[y * ScreenWidth + x] = color;
+#endif
+}
+
+ScreenPixel getpix(const ScreenPixel* pixels, const int x, const int y)
+{
+#ifdef FLIP
+    return pixels[x * ScreenHeight + y];
+#else
+    return pixels[y * ScreenWidth + x];
+#endif
+}
+
+#if 0
+
+const int DefaultMapW = 4;
+const int DefaultMapH = 4;
+
+// (0,0) at bottom left.
+const uint8_t DefaultMap[DefaultMapW * DefaultMapH] =
+{
+    1, 1, 1, 1,
+    1, 0, 0, 1,
+    1, 0, 0, 1,
+    1, 1, 1, 1
+};
+
+#else
+
+const int DefaultMapW = 8;
+const int DefaultMapH = 8;
+
+// (0,0) at bottom left.
+const uint8_t DefaultMap[DefaultMapW * DefaultMapH] =
+{
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 0, 0, 0, 0, 0, 0, 1,
+    1, 0, 0, 1, 1, 1, 0, 1,
+    1, 0, 0, 0, 0, 1, 0, 1,
+    1, 0, 0, 1, 0, 0, 0, 1,
+    1, 0, 0, 1, 0, 1, 1, 1,
+    1, 0, 0, 1, 0, 0, 0, 1,
+    1, 1, 1, 1, 1, 1, 1, 1
+};
+
+#endif
+
+void generate_map(const int w, const int h, const float density, const uint32_t seed, Map* m)
+{
+    Player start;
+    start.reset();
+
+    const int startx = static_cast<int>(start.x);
+    const int starty = static_cast<int>(start.y);
+    myassert(startx < w - 1 && starty < h - 1);
+
+    m->w = w;
+    m->h = h;
+    m->cells.assign(w * h, 0);
+
+    // Xorshift, so that a seed gives the same map on every platform.
+    uint32_t state = seed != 0 ? seed : 1;
+
+    for (int iy = 0; iy < h; ++iy)
+    {
+        for (int ix = 0; ix < w; ++ix)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+
+            const bool border = ix == 0 || iy == 0 || ix == w - 1 || iy == h - 1;
+            const bool start = ix == startx && iy == starty;
+            const bool wall = border || (!start && static_cast<float>(state >> 8) / 16777216.0f < density);
+
+            m->cells[(h - 1 - iy) * w + ix] = wall ? 1 : 0;
+        }
+    }
+}
+
+bool is_valid_map(const Map& m)
+{
+    Player start;
+    start.reset();
+
+    const int startx = static_cast<int>(start.x);
+    const int starty = static_cast<int>(start.y);
+
+    if (m.w <= startx + 1 || m.h <= starty + 1 || m.cells.size() != static_cast<size_t>(m.w) * m.h)
+        return false;
+
+    for (int iy = 0; iy < m.h; ++iy)
+    {
+        for (int ix = 0; ix < m.w; ++ix)
+        {
+            const bool border = ix == 0 || iy == 0 || ix == m.w - 1 || iy == m.h - 1;
+            if (border && map(m, ix, iy) == 0)
+                return false;
+        }
+    }
+
+    return map(m, startx, starty) == 0;
+}
+
+uint8_t safemap(const Map& m, const int ix, const int iy)
+{
+    return
+        ix >= 0 &&
+        iy >= 0 &&
+        ix <= m.w - 1 &&
+        iy <= m.h - 1
+            ? m.cells[(m.h - 1 - iy) * m.w + ix]
+            : 1;
+}
+
+uint8_t map(const Map& m, const int ix, const int iy)
+{
+    myassert(
+        ix >= 0 &&
+        iy >= 0 &&
+        ix <= m.w - 1 &&
+        iy <= m.h - 1);
+    return safemap(m, ix, iy);
+}
+
+void setmap(World* world, const int ix, const int iy, const uint8_t cell)
+{
+    Map& m = world->map;
+    myassert(
+        ix >= 0 &&
+        iy >= 0 &&
+        ix <= m.w - 1 &&
+        iy <= m.h - 1);
+    const int i = (m.h - 1 - iy) * m.w + ix;
+    m.cells[i] = cell;
+    world->mapchanges.push_back(iy * m.w + ix);
+
+    if (!world->basechanged[i])
+    {
+        world->basechanged[i] = 1;
+        world->basechanges.push_back(i);
+    }
+}
+
+// Per second.
+const float PlayerWalkSpeed = 1.8f;
+const float PlayerRunSpeed = 3.6f;
+const float PlayerRotateSpeed = dtor(300.0f);
+
+// Largest on-screen size of the minimap; larger maps scroll with the player.
+const int MinimapMaxWidth = 320;
+const int MinimapMaxHeight = 320;
+
+// Length of the view cone edges, in map units.
+const float MinimapConeLength = 1.0f;
+
+bool load_texture(Texture* tex, const char* filepath)
+{
+    free_texture(tex);
+
+    const string cachepath = texture_cache_path(filepath);
+
+    MappedFile source;
+    const bool hassource = source.open(filepath);
+
+    TextureCacheHeader header;
+    if (!open_texture_cache(cachepath.c_str(), hassource ? &source : nullptr, &tex->cache, &header))
+    {
+        if (!hassource)
+            return false;
+
+        tex->pixels = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &tex->w, &tex->h, &tex->n, 4);
+        if (tex->pixels == nullptr)
+            return false;
+
+        tex->data = tex->pixels;
+
+        memset(&header, 0, sizeof(header));
+        header.sourcesize = source.size();
+        header.sourcehash = fnv1a(source.data(), source.size());
+        header.w = tex->w;
+        header.h = tex->h;
+        header.n = tex->n;
+
+        // Keep the decoded image if the cache cannot be written, such as in a read-only directory.
+        if (!write_texture_cache(cachepath.c_str(), header, tex->pixels) ||
+            !open_texture_cache(cachepath.c_str(), nullptr, &tex->cache, &header))
+            return true;
+
+        // Use the cache from now on too, so that its pages are shared with other processes.
+        stbi_image_free(tex->pixels);
+        tex->pixels = nullptr;
+    }
+
+    tex->w = static_cast<int>(header.w);
+    tex->h = static_cast<int>(header.h);
+    tex->n = static_cast<int>(header.n);
+    tex->data = tex->cache.data() + TextureCacheDataOffset;
+
+    return true;
+}
+
+bool load_texture(Texture* tex, const AssetPack& pack, const char* name)
+{
+    free_texture(tex);
+
+    const AssetEntry* entry = pack.find(name, AssetTexture);
+    if (entry == nullptr)
+        return false;
+
+    tex->w = static_cast<int>(entry->w);
+    tex->h = static_cast<int>(entry->h);
+    tex->n = 4;
+    tex->data = pack.data(*entry);
+
+    return true;
+}
+
+void free_texture(Texture* tex)
+{
+    stbi_image_free(tex->pixels);
+    tex->pixels = nullptr;
+    tex->cache.close();
+    tex->data = nullptr;
+}
+
+const uint8_t* lookup_texture(const Texture* tex, int x, int y)
+{
+    if (x < 0) x += tex->w;
+    if (y < 0) y += tex->h;
+    if (x > tex->w - 1) x -= tex->w;
+    if (y > tex->h - 1) y -= tex->h;
+    return &tex->data[(y * tex->w + x) * 4];
+}
+
+// Texture walls are drawn with during the current frame.
+const Texture& wall_texture(const Engine& engine)
+{
+    return engine.streamer.is_started() ? engine.streamer.use(0) : engine.textures[0];
+}
+
+const char* TextureFilePaths[NumTextures] =
+{
+    "textures/407.png"
+};
+
+const char* DefaultMapAsset = "maps/default.txt";
+
+void destroy_minimap_layer(MinimapLayer* layer);
+
+World::World()
+  : tickrate(DefaultTickRate)
+  , texture(true)
+  , bilinear(false)
+  , minimap(false)
+  , minimapcellsize(DefaultMinimapCellSize)
+{
+    minimaplayer.pixels = nullptr;
+
+    load_default_map(this);
+
+    player.reset();
+    prevplayer = player;
+}
+
+World::~World()
+{
+    destroy_minimap_layer(&minimaplayer);
+}
+
+// Blend between the player before and after the last tick.
+Player interpolate_player(const World& world, const float alpha)
+{
+    const Player& player = world.player;
+    const Player& prevplayer = world.prevplayer;
+
+    Player result;
+    result.x = prevplayer.x + (player.x - prevplayer.x) * alpha;
+    result.y = prevplayer.y + (player.y - prevplayer.y) * alpha;
+    result.a = prevplayer.a + (player.a - prevplayer.a) * alpha;
+    return result;
+}
+
+FrameState capture_frame_state(World* world, const float alpha)
+{
+    FrameState state;
+    state.player = interpolate_player(*world, alpha);
+    state.texture = world->texture;
+    state.bilinear = world->bilinear;
+    state.minimap = world->minimap;
+    state.minimapcellsize = world->minimapcellsize;
+    state.mapchanges.swap(world->mapchanges);
+    return state;
+}
+
+bool init(Engine* engine)
+{
+    bool success = true;
+
+    for (int i = 0; i < NumTextures; ++i)
+    {
+        engine->textures[i].data = nullptr;
+        engine->textures[i].pixels = nullptr;
+        if (!load_texture(&engine->textures[i], TextureFilePaths[i]))
+            success = false;
+    }
+
+    return success;
+}
+
+bool init(Engine* engine, const char* packpath)
+{
+    for (int i = 0; i < NumTextures; ++i)
+    {
+        engine->textures[i].data = nullptr;
+        engine->textures[i].pixels = nullptr;
+    }
+
+    if (!engine->pack.open(packpath))
+        return false;
+
+    bool success = true;
+
+    for (int i = 0; i < NumTextures; ++i)
+    {
+        if (!load_texture(&engine->textures[i], engine->pack, TextureFilePaths[i]))
+            success = false;
+    }
+
+    return success;
+}
+
+bool cast_ray(
+    const Map& m,
+    const float x0, const float y0,
+    const float x1, const float y1,
+    float* hx, float* hy,
+    float* u,
+    int* cell)
+{
+    myassert(x0 >= 0.0f && x0 < static_cast<float>(m.w));
+    myassert(y0 >= 0.0f && y0 < static_cast<float>(m.h));
+
+    float x = x0;
+    float y = y0;
+
+    int ix = static_cast<int>(x);
+    int iy = static_cast<int>(y);
+
+    if (x == ix && x1 < x0)
+        ix -= 1;
+
+    if (y == iy && y1 < y0)
+        iy -= 1;
+
+    myassert(map(m, ix, iy) == 0);
+
+    const int ix1 = static_cast<int>(x1);
+    const int iy1 = static_cast<int>(y1);
+
+    while (true)
+    {
+        const float dx = x1 - x;
+        const float dy = y1 - y;
+
+        float wallx, tx;
+        if (dx > 0.0f)
+        {
+            wallx = ceil(x);
+            if (x == wallx)
+                wallx += 1.0f;
+            myassert(x < wallx);
+
+            tx = (wallx - x) / dx;
+            myassert(tx > 0.0f);
+        }
+        else if (dx < 0.0f)
+        {
+            wallx = floor(x);
+            if (x == wallx)
+                wallx -= 1.0f;
+            myassert(x > wallx);
+
+            tx = (wallx - x) / dx;
+            myassert(tx > 0.0f);
+        }
+        else tx = Infinity;
+
+        float wally, ty;
+        if (dy > 0.0f)
+        {
+            wally = ceil(y);
+            if (y == wally)
+                wally += 1.0f;
+            myassert(y < wally);
+
+            ty = (wally - y) / dy;
+            myassert(ty > 0.0f);
+        }
+        else if (dy < 0.0f)
+        {
+            wally = floor(y);
+            if (y == wally)
+                wally -= 1.0f;
+            myassert(y > wally);
+
+            ty = (wally - y) / dy;
+            myassert(ty > 0.0f);
+        }
+        else ty = Infinity;
+
+        myassert(tx < Infinity || ty < Infinity);
+
+        if (tx < ty)
+        {
+            x = wallx;
+            y += tx * dy;
+
+            myassert(dx != 0.0f);
+            if (dx > 0.0f)
+            {
+                ix += 1;
+                myassert(ix == static_cast<int>(x));
+                myassert(ix <= m.w - 1);
+                iy = static_cast<int>(y);
+            }
+            else
+            {
+                ix -= 1;
+                //myassert(ix == static_cast<int>(x));
+                myassert(ix >= 0);
+                iy = static_cast<int>(y);
+            }
+
+            if (map(m, ix, iy) != 0)
+            {
+                *hx = x;
+                *hy = y;
+                *u = y - iy;
+                *cell = iy * m.w + ix;
+                return true;
+            }
+        }
+        else
+        {
+            x += ty * dx;
+            y = wally;
+
+            myassert(dy != 0.0f);
+            if (dy > 0.0f)
+            {
+                iy += 1;
+                myassert(iy == static_cast<int>(y));
+                myassert(iy <= m.h - 1);
+                ix = static_cast<int>(x);
+            }
+            else
+            {
+                iy -= 1;
+                //myassert(iy == static_cast<int>(y));
+                myassert(iy >= 0);
+                ix = static_cast<int>(x);
+            }
+
+            if (map(m, ix, iy) != 0)
+            {
+                *hx = x;
+                *hy = y;
+                *u = x - ix;
+                *cell = iy * m.w + ix;
+                return true;
+            }
+        }
+
+        if (ix == ix1 && iy == iy1)
+            return false;
+    }
+}
+
+bool cast_ray(
+    const Map& m,
+    const float x0, const float y0,
+    const float x1, const float y1,
+    float* hx, float* hy,
+    float* u)
+{
+    int cell;
+    return cast_ray(m, x0, y0, x1, y1, hx, hy, u, &cell);
+}
+
+void update(World* world, const uint32_t input, const float dt)
+{
+    const Map& m = world->map;
+    Player& player = world->player;
+
+    float dx = 0.0f, dy = 0.0f;
+
+    const float movespeed = ((input & InputRun) ? PlayerRunSpeed : PlayerWalkSpeed) * dt;
+    const float rotatespeed = PlayerRotateSpeed * dt;
+
+    if (input & InputLeft)
+    {
+        if (input & InputStrafe)
+        {
+            dx += movespeed * cos(player.a + Pi / 2.0f);
+            dy += movespeed * sin(player.a + Pi / 2.0f);
+        }
+        else player.a += rotatespeed;
+    }
+
+    if (input & InputRight)
+    {
+        if (input & InputStrafe)
+        {
+            dx += movespeed * cos(player.a - Pi / 2.0f);
+            dy += movespeed * sin(player.a - Pi / 2.0f);
+        }
+        else player.a -= rotatespeed;
+    }
+
+    if (input & InputForward)
+    {
+        dx += movespeed * cos(player.a);
+        dy += movespeed * sin(player.a);
+    }
+
+    if (input & InputBackward)
+    {
+        dx -= movespeed * cos(player.a);
+        dy -= movespeed * sin(player.a);
+    }
+
+    const int ix = static_cast<int>(player.x);
+    const int iy = static_cast<int>(player.y);
+
+    myassert(map(m, ix, iy) == 0);
+
+    for (int y = iy - 1; y <= iy + 1; ++y)
+    {
+        for (int x = ix - 1; x <= ix + 1; ++x)
+        {
+            if (x == ix && y == iy)
+                continue;
+
+            if (safemap(m, x, y) != 0)
+            {
+                const float blockx0 = x - WallPadding;
+                const float blocky0 = y - WallPadding;
+                const float blockx1 = x + 1 + WallPadding;
+                const float blocky1 = y + 1 + WallPadding;
+
+                if (dx > 0.0f && safemap(m, x - 1, y) == 0)
+                {
+                    const float t = (blockx0 - player.x) / dx;
+                    if (t >= 0.0f && t < 1.0f)
+                    {
+                        const float ay = player.y + t * dy;
+                        if (ay >= blocky0 && ay <= blocky1)
+                        {
+                            dx = blockx0 - player.x;
+                        }
+                    }
+                }
+
+                if (dx < 0.0f && safemap(m, x + 1, y) == 0)
+                {
+                    const float t = (blockx1 - player.x) / dx;
+                    if (t >= 0.0f && t < 1.0f)
+                    {
+                        const float ay = player.y + t * dy;
+                        if (ay >= blocky0 && ay <= blocky1)
+                        {
+                            dx = blockx1 - player.x;
+                        }
+                    }
+                }
+
+                if (dy > 0.0f && safemap(m, x, y - 1) == 0)
+                {
+                    const float t = (blocky0 - player.y) / dy;
+                    if (t >= 0.0f && t < 1.0f)
+                    {
+                        const float ax = player.x + t * dx;
+                        if (ax >= blockx0 && ax <= blockx1)
+                        {
+                            dy = blocky0 - player.y;
+                        }
+                    }
+                }
+
+                if (dy < 0.0f && safemap(m, x, y + 1) == 0)
+                {
+                    const float t = (blocky1 - player.y) / dy;
+                    if (t >= 0.0f && t < 1.0f)
+                    {
+                        const float ax = player.x + t * dx;
+                        if (ax >= blockx0 && ax <= blockx1)
+                        {
+                            dy = blocky1 - player.y;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    player.x += dx;
+    player.y += dy;
+}
+
+void step(World* world, const uint32_t input, const int numticks)
+{
+    const float dt = 1.0f / world->tickrate;
+
+    for (int i = 0; i < numticks; ++i)
+    {
+        if (i == 0 && (input & InputReset))
+            world->player.reset();
+
+        world->prevplayer = world->player;
+        update(world, input, dt);
+    }
+}
+
+void reset_player(World* world)
+{
+    world->player.reset();
+    world->prevplayer = world->player;
+}
+
+// Number of screen columns per work-stealing tile.
+const int ColumnTileSize = 16;
+
+// Number of screen rows per band when filling row by row.
+const int RowTileSize = 8;
+
+// Number of worlds per work-stealing tile when stepping a batch.
+const int BatchStepTileSize = 4;
+
+void project_column(
+    const Texture& tex,
+    const float d, const float u,
+    const bool bilinear,
+    const int width, const int height,
+    Column* col)
+{
+    const float h = FocalLength * WallHeight / d;
+
+    // Square pixels: the film is as high as the frame is relative to its width.
+    const float filmheight = FilmWidth * height / width;
+
+    const int wallheight = static_cast<int>(h / filmheight * height);
+    const int wallstarty = height / 2 - wallheight / 2;
+    const int wallendy = height / 2 + wallheight / 2;
+
+    col->hit = true;
+    col->d = d;
+    col->shade = 1.0f - min(d / 8.0f, 1.0f);
+    col->rcpwallheight = 1.0f / wallheight;
+    col->wallstarty = wallstarty;
+    col->starty = max(wallstarty, 0);
+    col->endy = min(wallendy, height);
+
+    if (bilinear)
+    {
+        const float su = u * tex.w - 0.5f;
+        col->iu = static_cast<int>(floor(su));
+        col->fu = su - col->iu;
+        myassert(col->fu >= 0.0f && col->fu < 1.0f);
+    }
+    else
+    {
+        const float su = u * tex.w;
+        col->iu = static_cast<int>(su);
+        col->fu = su - col->iu;
+        myassert(col->iu >= 0 && col->iu < tex.w);
+        myassert(col->fu >= 0.0f && col->fu < 1.0f);
+    }
+}
+
+void project_column(const Texture& tex, const float d, const float u, const bool bilinear, Column* col)
+{
+    project_column(tex, d, u, bilinear, ScreenWidth, ScreenHeight, col);
+}
+
+// Cast column x of a frame of the given size.
+void cast_column(
+    const Engine& engine,
+    const World& world,
+    const FrameState& state,
+    const int width, const int height,
+    const int x,
+    Column* col)
+{
+    const float sx = (FilmWidth * 0.5f) - (x + 0.5f) * (FilmWidth / width);
+    const float a = state.player.a + atan2(sx, FocalLength);
+
+    const float MaxDist = 1000.0f;
+    float hx, hy;
+    float u;
+    col->hit =
+        cast_ray(
+            world.map,
+            state.player.x, state.player.y,
+            state.player.x + MaxDist * cos(a),
+            state.player.y + MaxDist * sin(a),
+            &hx, &hy,
+            &u,
+            &col->cell);
+
+    if (!col->hit)
+        return;
+
+    const float dx = hx - state.player.x;
+    const float dy = hy - state.player.y;
+    const float d = sqrt(dx * dx + dy * dy) * cos(a - state.player.a);
+
+    project_column(wall_texture(engine), d, u, state.bilinear, width, height, col);
+}
+
+void cast_column(const Engine& engine, const World& world, const FrameState& state, const int x, Column* col)
+{
+    cast_column(engine, world, state, ScreenWidth, ScreenHeight, x, col);
+}
+
+template <int Mode>
+ScreenPixel wall_pixel(const Texture& tex, const Column& col, const int y)
+{
+    if (Mode == WallBilinear)
+    {
+        const float fu0 = col.fu;
+        const float fu1 = 1.0f - fu0;
+
+        const float v = (y - col.wallstarty + 0.5f) * col.rcpwallheight;
+        const float sv = v * tex.h - 0.5f;
+        const int iv = static_cast<int>(floor(sv));
+        const float fv0 = sv - iv;
+        const float fv1 = 1.0f - fv0;
+        myassert(fv0 >= 0.0f && fv0 < 1.0f);
+
+        const uint8_t* data00 = lookup_texture(&tex, col.iu + 0, iv + 0);
+        const uint8_t* data10 = lookup_texture(&tex, col.iu + 1, iv + 0);
+        const uint8_t* data01 = lookup_texture(&tex, col.iu + 0, iv + 1);
+        const uint8_t* data11 = lookup_texture(&tex, col.iu + 1, iv + 1);
+
+        float r = (data00[0] * fu1 + data10[0] * fu0) * fv1 + (data01[0] * fu1 + data11[0] * fu0) * fv0;
+        float g = (data00[1] * fu1 + data10[1] * fu0) * fv1 + (data01[1] * fu1 + data11[1] * fu0) * fv0;
+        float b = (data00[2] * fu1 + data10[2] * fu0) * fv1 + (data01[2] * fu1 + data11[2] * fu0) * fv0;
+
+        r *= col.shade;
+        g *= col.shade;
+        b *= col.shade;
+
+        return
+            rgb(
+                static_cast<uint8_t>(r),
+                static_cast<uint8_t>(g),
+                static_cast<uint8_t>(b));
+    }
+    else if (Mode == WallNearest)
+    {
+        const float v = (y - col.wallstarty + 0.5f) * col.rcpwallheight;
+        const float sv = v * tex.h;
+        const int iv = static_cast<int>(sv);
+        myassert(iv >= 0 && iv < tex.h);
+
+        const uint8_t* data = &tex.data[(iv * tex.w + col.iu) * 4];
+
+        return
+            rgb(
+                static_cast<uint8_t>(data[0] * col.shade),
+                static_cast<uint8_t>(data[1] * col.shade),
+                static_cast<uint8_t>(data[2] * col.shade));
+    }
+    else return rgb(80, 80, 80);
+}
+
+const ScreenPixel SkyColor = rgb(155, 226, 255);
+const ScreenPixel FloorColor = rgb(53, 37, 26);
+
+void fill_sky_floor(const Column& col, ScreenPixel* pixels, const int x)
+{
+    if (!col.hit)
+        return;
+
+    // Sky.
+    for (int y = 0; y < col.starty; ++y)
+        setpix(pixels, x, y, SkyColor);
+
+    // Floor.
+    for (int y = col.endy; y < ScreenHeight; ++y)
+        setpix(pixels, x, y, FloorColor);
+}
+
+template <int Mode>
+void fill_wall(const Texture& tex, const Column& col, ScreenPixel* pixels, const int x)
+{
+    if (!col.hit)
+        return;
+
+    for (int y = col.starty; y < col.endy; ++y)
+        setpix(pixels, x, y, wall_pixel<Mode>(tex, col, y));
+}
+
+// Threads get bands of whole rows so that they never share cache lines.
+template <int Mode>
+void fill_rows(const Texture& tex, const Column* columns, ScreenPixel* pixels, const int begin, const int end)
+{
+    for (int y = begin; y < end; ++y)
+    {
+        ScreenPixel* row = &pixels[y * ScreenWidth];
+
+        for (int x = 0; x < ScreenWidth; ++x)
+        {
+            const Column& col = columns[x];
+
+            if (!col.hit)
+                continue;
+
+            if (y < col.starty)
+                row[x] = SkyColor;
+            else if (y >= col.endy)
+                row[x] = FloorColor;
+            else row[x] = wall_pixel<Mode>(tex, col, y);
+        }
+    }
+}
+
+template void fill_wall<WallFlat>(const Texture& tex, const Column& col, ScreenPixel* pixels, const int x);
+template void fill_wall<WallNearest>(const Texture& tex, const Column& col, ScreenPixel* pixels, const int x);
+template void fill_wall<WallBilinear>(const Texture& tex, const Column& col, ScreenPixel* pixels, const int x);
+
+template void fill_rows<WallFlat>(const Texture& tex, const Column* columns, ScreenPixel* pixels, const int begin, const int end);
+template void fill_rows<WallNearest>(const Texture& tex, const Column* columns, ScreenPixel* pixels, const int begin, const int end);
+template void fill_rows<WallBilinear>(const Texture& tex, const Column* columns, ScreenPixel* pixels, const int begin, const int end);
+
+WallMode wall_mode(const FrameState& state)
+{
+    return
+        !state.texture ? WallFlat :
+        state.bilinear ? WallBilinear :
+        WallNearest;
+}
+
+#ifdef FLIP
+
+// Cast and fill screen columns [begin, end) of a frame.
+template <int Mode>
+void render_columns(
+    const Engine& engine,
+    const World& world,
+    const FrameState& state,
+    ScreenPixel* pixels,
+    FrameProfile* profile,
+    const int begin, const int end,
+    const int worker)
+{
+    TraceScope scope("columns", begin);
+
+    const Texture& tex = wall_texture(engine);
+    uint64_t* times = profile->thread(worker);
+    Column columns[ColumnTileSize];
+
+    {
+        ScopedTimer timer(&times[StageRayCast]);
+        ScopedCounters counters(profile->thread_counters(worker, StageRayCast));
+        for (int x = begin; x < end; ++x)
+            cast_column(engine, world, state, x, &columns[x - begin]);
+    }
+
+    {
+        ScopedTimer timer(&times[StageSkyFloorFill]);
+        ScopedCounters counters(profile->thread_counters(worker, StageSkyFloorFill));
+        for (int x = begin; x < end; ++x)
+            fill_sky_floor(columns[x - begin], pixels, x);
+    }
+
+    {
+        ScopedTimer timer(&times[StageWallFill]);
+        ScopedCounters counters(profile->thread_counters(worker, StageWallFill));
+        for (int x = begin; x < end; ++x)
+            fill_wall<Mode>(tex, columns[x - begin], pixels, x);
+    }
+}
+
+void render_columns(
+    const Engine& engine,
+    const World& world,
+    const FrameState& state,
+    ScreenPixel* pixels,
+    FrameProfile* profile,
+    const int begin, const int end,
+    const int worker)
+{
+    switch (wall_mode(state))
+    {
+      case WallFlat: render_columns<WallFlat>(engine, world, state, pixels, profile, begin, end, worker); break;
+      case WallNearest: render_columns<WallNearest>(engine, world, state, pixels, profile, begin, end, worker); break;
+      case WallBilinear: render_columns<WallBilinear>(engine, world, state, pixels, profile, begin, end, worker); break;
+    }
+}
+
+template <int Mode>
+void renderview(Engine* engine, World* world, const FrameState& state, ScreenPixel* pixels, FrameProfile* profile)
+{
+    engine->pool.parallel_for(ScreenWidth, ColumnTileSize, [engine, world, &state, pixels, profile](const int begin, const int end, const int worker)
+    {
+        render_columns<Mode>(*engine, *world, state, pixels, profile, begin, end, worker);
+    });
+}
+
+#else
+
+// Cast screen columns [begin, end) of a frame into world.columns.
+void cast_columns(
+    const Engine& engine,
+    World& world,
+    const FrameState& state,
+    FrameProfile* profile,
+    const int begin, const int end,
+    const int worker)
+{
+    TraceScope scope("cast columns", begin);
+    ScopedTimer timer(&profile->thread(worker)[StageRayCast]);
+    ScopedCounters counters(profile->thread_counters(worker, StageRayCast));
+    for (int x = begin; x < end; ++x)
+        cast_column(engine, world, state, x, &world.columns[x]);
+}
+
+// Fill screen rows [begin, end) of a frame from its cast columns. Sky and
+// floor are filled in the same pass and counted as wall fill.
+template <int Mode>
+void render_rows(
+    const Engine& engine,
+    const World& world,
+    ScreenPixel* pixels,
+    FrameProfile* profile,
+    const int begin, const int end,
+    const int worker)
+{
+    TraceScope scope("fill rows", begin);
+    ScopedTimer timer(&profile->thread(worker)[StageWallFill]);
+    ScopedCounters counters(profile->thread_counters(worker, StageWallFill));
+    fill_rows<Mode>(wall_texture(engine), world.columns.data(), pixels, begin, end);
+}
+
+void render_rows(
+    const Engine& engine,
+    const World& world,
+    const FrameState& state,
+    ScreenPixel* pixels,
+    FrameProfile* profile,
+    const int begin, const int end,
+    const int worker)
+{
+    switch (wall_mode(state))
+    {
+      case WallFlat: render_rows<WallFlat>(engine, world, pixels, profile, begin, end, worker); break;
+      case WallNearest: render_rows<WallNearest>(engine, world, pixels, profile, begin, end, worker); break;
+      case WallBilinear: render_rows<WallBilinear>(engine, world, pixels, profile, begin, end, worker); break;
+    }
+}
+
+template <int Mode>
+void renderview(Engine* engine, World* world, const FrameState& state, ScreenPixel* pixels, FrameProfile* profile)
+{
+    world->columns.resize(ScreenWidth);
+
+    engine->pool.parallel_for(ScreenWidth, ColumnTileSize, [engine, world, &state, profile](const int begin, const int end, const int worker)
+    {
+        cast_columns(*engine, *world, state, profile, begin, end, worker);
+    });
+
+    engine->pool.parallel_for(ScreenHeight, RowTileSize, [engine, world, pixels, profile](const int begin, const int end, const int worker)
+    {
+        render_rows<Mode>(*engine, *world, pixels, profile, begin, end, worker);
+    });
+}
+
+#endif
+
+void renderview(Engine* engine, World* world, const FrameState& state, ScreenPixel* pixels, FrameProfile* profile)
+{
+    switch (wall_mode(state))
+    {
+      case WallFlat: renderview<WallFlat>(engine, world, state, pixels, profile); break;
+      case WallNearest: renderview<WallNearest>(engine, world, state, pixels, profile); break;
+      case WallBilinear: renderview<WallBilinear>(engine, world, state, pixels, profile); break;
+    }
+}
+
+ScreenPixel* layerpix(const MinimapLayer& layer, const int x, const int y)
+{
+#ifdef FLIP
+    return &layer.pixels[x * layer.h + y];
+#else
+    return &layer.pixels[y * layer.w + x];
+#endif
+}
+
+// Color of the static minimap at pixel (x, y), with (0,0) at bottom left.
+ScreenPixel minimap_color(const Map& m, const int cellsize, const int x, const int y)
+{
+    const float wx = static_cast<float>(x) / cellsize;
+    const float wy = static_cast<float>(y) / cellsize;
+
+    const int ix = static_cast<int>(wx);
+    const int iy = static_cast<int>(wy);
+
+    const uint8_t cell = map(m, ix, iy);
+    ScreenPixel color = cell == 0 ? rgb(150, 150, 150) : rgb(220, 220, 220);
+
+    const float fx = wx - ix;
+    const float fy = wy - iy;
+
+    if (cell == 0)
+    {
+        if ((fx <= WallPadding && safemap(m, ix - 1, iy) != 0) ||
+            (fx >= 1.0f - WallPadding && safemap(m, ix + 1, iy) != 0) ||
+            (fy <= WallPadding && safemap(m, ix, iy - 1) != 0) ||
+            (fy >= 1.0f - WallPadding && safemap(m, ix, iy + 1) != 0) ||
+            (fx <= WallPadding && fy <= WallPadding && safemap(m, ix - 1, iy - 1) != 0) ||
+            (fx >= 1.0f - WallPadding && fy <= WallPadding && safemap(m, ix + 1, iy - 1) != 0) ||
+            (fx <= WallPadding && fy >= 1.0f - WallPadding && safemap(m, ix - 1, iy + 1)) ||
+            (fx >= 1.0f - WallPadding && fy >= 1.0f - WallPadding && safemap(m, ix + 1, iy + 1) != 0))
+            color = rgb(150, 180, 150);
+    }
+
+    return color;
+}
+
+void rasterize_minimap(const Map& m, const MinimapLayer& layer, const int x0, const int y0, const int x1, const int y1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        for (int x = x0; x < x1; ++x)
+            *layerpix(layer, x, layer.h - 1 - y) = minimap_color(m, layer.cellsize, x, y);
+    }
+}
+
+void build_minimap_layer(Engine* engine, const Map& m, MinimapLayer* layer, const int cellsize)
+{
+    delete[] layer->pixels;
+
+    layer->cellsize = cellsize;
+    layer->w = m.w * cellsize;
+    layer->h = m.h * cellsize;
+    layer->pixels = new ScreenPixel[layer->w * layer->h];
+
+    engine->pool.parallel_for(layer->h, cellsize, [&m, layer](const int begin, const int end, const int worker)
+    {
+        TraceScope scope("minimap rows", begin);
+        rasterize_minimap(m, *layer, 0, begin, layer->w, end);
+    });
+}
+
+// Re-rasterize a changed cell and its neighbours, whose wall padding depends on it.
+void patch_minimap_layer(const Map& m, const MinimapLayer& layer, const int cell)
+{
+    const int ix = cell % m.w;
+    const int iy = cell / m.w;
+
+    const int ix0 = max(ix - 1, 0);
+    const int iy0 = max(iy - 1, 0);
+    const int ix1 = min(ix + 2, m.w);
+    const int iy1 = min(iy + 2, m.h);
+
+    rasterize_minimap(
+        m,
+        layer,
+        ix0 * layer.cellsize, iy0 * layer.cellsize,
+        ix1 * layer.cellsize, iy1 * layer.cellsize);
+}
+
+void destroy_minimap_layer(MinimapLayer* layer)
+{
+    delete[] layer->pixels;
+    layer->pixels = nullptr;
+}
+
+struct MinimapViewport
+{
+    int x, y;       // top left corner in the layer
+    int w, h;
+};
+
+void plot_minimap(ScreenPixel* pixels, const MinimapViewport& vp, const int lx, const int ly, const ScreenPixel& color)
+{
+    const int x = lx - vp.x;
+    const int y = ly - vp.y;
+
+    if (x >= 0 && y >= 0 && x < vp.w && y < vp.h)
+        setpix(pixels, x, y, color);
+}
+
+void rendermap(Engine* engine, World* world, const FrameState& state, ScreenPixel* pixels)
+{
+    MinimapLayer& minimaplayer = world->minimaplayer;
+    if (minimaplayer.pixels == nullptr || minimaplayer.cellsize != state.minimapcellsize)
+        build_minimap_layer(engine, world->map, &minimaplayer, state.minimapcellsize);
+
+    const MinimapLayer& layer = minimaplayer;
+    const float cellsize = static_cast<float>(layer.cellsize);
+
+    // Scroll to keep the player centered.
+    const float px = state.player.x * cellsize;
+    const float py = layer.h - state.player.y * cellsize;
+
+    MinimapViewport vp;
+    vp.w = min(layer.w, MinimapMaxWidth);
+    vp.h = min(layer.h, MinimapMaxHeight);
+    vp.x = min(max(static_cast<int>(px) - vp.w / 2, 0), layer.w - vp.w);
+    vp.y = min(max(static_cast<int>(py) - vp.h / 2, 0), layer.h - vp.h);
+
+#ifdef FLIP
+    for (int x = 0; x < vp.w; ++x)
+        memcpy(&pixels[x * ScreenHeight], layerpix(layer, vp.x + x, vp.y), vp.h * sizeof(ScreenPixel));
+#else
+    for (int y = 0; y < vp.h; ++y)
+        memcpy(&pixels[y * ScreenWidth], layerpix(layer, vp.x, vp.y + y), vp.w * sizeof(ScreenPixel));
+#endif
+
+    // View cone.
+    for (int side = -1; side <= 1; side += 2)
+    {
+        const float a = state.player.a + side * HFov / 2.0f;
+        const float dx = cos(a) * MinimapConeLength * cellsize;
+        const float dy = -sin(a) * MinimapConeLength * cellsize;
+        const int steps = static_cast<int>(max(fabs(dx), fabs(dy)));
+
+        for (int i = 1; i <= steps; ++i)
+        {
+            const float t = static_cast<float>(i) / steps;
+            plot_minimap(
+                pixels, vp,
+                static_cast<int>(px + t * dx),
+                static_cast<int>(py + t * dy),
+                rgb(255, 140, 0));
+        }
+    }
+
+    // Player.
+    const float Radius = 0.05f;
+    const int x0 = static_cast<int>((state.player.x - Radius) * cellsize);
+    const int y0 = static_cast<int>((state.player.y - Radius) * cellsize);
+    const int x1 = static_cast<int>((state.player.x + Radius) * cellsize) + 1;
+    const int y1 = static_cast<int>((state.player.y + Radius) * cellsize) + 1;
+
+    for (int y = max(y0, 0); y <= y1; ++y)
+    {
+        for (int x = max(x0, 0); x <= x1; ++x)
+        {
+            const float dpx = static_cast<float>(x) / layer.cellsize - state.player.x;
+            const float dpy = static_cast<float>(y) / layer.cellsize - state.player.y;
+            if (sqrt(dpx * dpx + dpy * dpy) <= Radius)
+                plot_minimap(pixels, vp, x, layer.h - 1 - y, rgb(255, 0, 0));
+        }
+    }
+}
+
+// Bring the minimap layer up to date with the cells changed before a frame.
+void update_minimap_layer(World* world, const FrameState& state)
+{
+    const MinimapLayer& minimaplayer = world->minimaplayer;
+    if (minimaplayer.pixels != nullptr && minimaplayer.cellsize == state.minimapcellsize)
+    {
+        for (size_t i = 0; i < state.mapchanges.size(); ++i)
+            patch_minimap_layer(world->map, minimaplayer, state.mapchanges[i]);
+    }
+}
+
+// Bring the minimap layer up to date with the map and draw the minimap if enabled.
+void render_minimap(Engine* engine, World* world, const FrameState& state, ScreenPixel* pixels, FrameProfile* profile)
+{
+    update_minimap_layer(world, state);
+
+    if (state.minimap)
+    {
+        TraceScope scope("minimap");
+        ScopedTimer timer(&profile->stages[StageMinimap]);
+        ScopedCounters counters(profile->counters[StageMinimap]);
+        rendermap(engine, world, state, pixels);
+    }
+}
+
+void render(Engine* engine, World* world, const FrameState& state, ScreenPixel* pixels, FrameProfile* profile)
+{
+    TraceScope scope("render");
+
+    engine->streamer.update();
+
+    profile->numthreads = engine->pool.thread_count();
+
+    {
+        TraceScope scope("view");
+        ScopedTimer timer(&profile->stages[StageView]);
+        ScopedCounters counters(profile->counters[StageView]);
+        renderview(engine, world, state, pixels, profile);
+    }
+
+    profile->gather();
+
+    render_minimap(engine, world, state, pixels, profile);
+}
+
+void step_and_render(Engine* engine, const BatchItem* items, const int count, const int numticks, FrameProfile* profile)
+{
+    TraceScope scope("batch");
+
+    engine->streamer.update();
+
+    profile->numthreads = engine->pool.thread_count();
+
+    vector<FrameState> states(count);
+
+    {
+        TraceScope scope("update");
+        ScopedTimer timer(&profile->stages[StageUpdate]);
+        ScopedCounters counters(profile->counters[StageUpdate]);
+
+        engine->pool.parallel_for(count, BatchStepTileSize, [items, numticks, &states](const int begin, const int end, const int worker)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                World* world = items[i].world;
+                step(world, items[i].input, numticks);
+                states[i] = capture_frame_state(world, 1.0f);
+#ifndef FLIP
+                world->columns.resize(ScreenWidth);
+#endif
+            }
+        });
+    }
+
+    // Tiles never straddle two frames, so one dispatch spreads the columns
+    // of all frames over the workers however small the batch.
+    static_assert(ScreenWidth % ColumnTileSize == 0, "column tiles must not straddle frames");
+    static_assert(ScreenHeight % RowTileSize == 0, "row tiles must not straddle frames");
+
+    {
+        TraceScope scope("view");
+        ScopedTimer timer(&profile->stages[StageView]);
+        ScopedCounters counters(profile->counters[StageView]);
+
+#ifdef FLIP
+        engine->pool.parallel_for(count * ScreenWidth, ColumnTileSize, [engine, items, &states, profile](const int begin, const int end, const int worker)
+        {
+            const int i = begin / ScreenWidth;
+            const int x = begin - i * ScreenWidth;
+            render_columns(*engine, *items[i].world, states[i], items[i].pixels, profile, x, x + end - begin, worker);
+        });
+#else
+        engine->pool.parallel_for(count * ScreenWidth, ColumnTileSize, [engine, items, &states, profile](const int begin, const int end, const int worker)
+        {
+            const int i = begin / ScreenWidth;
+            const int x = begin - i * ScreenWidth;
+            cast_columns(*engine, *items[i].world, states[i], profile, x, x + end - begin, worker);
+        });
+
+        engine->pool.parallel_for(count * ScreenHeight, RowTileSize, [engine, items, &states, profile](const int begin, const int end, const int worker)
+        {
+            const int i = begin / ScreenHeight;
+            const int y = begin - i * ScreenHeight;
+            render_rows(*engine, *items[i].world, states[i], items[i].pixels, profile, y, y + end - begin, worker);
+        });
+#endif
+    }
+
+    profile->gather();
+
+    for (int i = 0; i < count; ++i)
+        render_minimap(engine, items[i].world, states[i], items[i].pixels, profile);
+}
+
+int observation_pixel_size(const ObservationFormat format)
+{
+    return format == ObservationBGRA8 ? 4 : 1;
+}
+
+// What row y of a column of a frame of the given height shows. Columns that
+// hit nothing show the horizon.
+PixelClass classify_pixel(const Column& col, const int y, const int height)
+{
+    if (!col.hit)
+        return y < height / 2 ? PixelSky : PixelFloor;
+
+    if (y < col.starty)
+        return PixelSky;
+    else if (y >= col.endy)
+        return PixelFloor;
+    else return PixelWall;
+}
+
+template <int Mode>
+ScreenPixel sample_column(const Texture& tex, const Column& col, const int y, const int height)
+{
+    switch (classify_pixel(col, y, height))
+    {
+      case PixelSky: return SkyColor;
+      case PixelFloor: return FloorColor;
+      default: return wall_pixel<Mode>(tex, col, y);
+    }
+}
+
+// Distance along the view direction to the floor seen at row y of a frame
+// of the given size; only meaningful below the horizon.
+float floor_depth(const int y, const int width, const int height)
+{
+    const float filmy = (y + 0.5f - height * 0.5f) * (FilmWidth / width);
+    return FocalLength * WallHeight * 0.5f / filmy;
+}
+
+void store_observation_pixel(const ObservationFormat format, const int r, const int g, const int b, uint8_t* out)
+{
+    switch (format)
+    {
+      case ObservationBGRA8:
+        out[0] = static_cast<uint8_t>(b);
+        out[1] = static_cast<uint8_t>(g);
+        out[2] = static_cast<uint8_t>(r);
+        out[3] = 255;
+        break;
+      case ObservationGray8: out[0] = static_cast<uint8_t>((77 * r + 150 * g + 29 * b + 128) >> 8); break;
+      case ObservationRed8: out[0] = static_cast<uint8_t>(r); break;
+      case ObservationGreen8: out[0] = static_cast<uint8_t>(g); break;
+      case ObservationBlue8: out[0] = static_cast<uint8_t>(b); break;
+    }
+}
+
+// Resolve row y of the pixels of an observation, averaging the samples of
+// every pixel.
+template <int Mode>
+void resolve_observation_row(
+    const Texture& tex,
+    const Column* columns,
+    const ObservationDesc& desc,
+    const int height,
+    const int y,
+    uint8_t* row)
+{
+    const int s = desc.supersampling;
+    const int pixelsize = observation_pixel_size(desc.format);
+    const int numsamples = s * s;
+
+    for (int x = 0; x < desc.width; ++x)
+    {
+        int r = 0, g = 0, b = 0;
+
+        for (int i = 0; i < s; ++i)
+        {
+            const Column& col = columns[x * s + i];
+
+            for (int j = 0; j < s; ++j)
+            {
+                const ScreenPixel p = sample_column<Mode>(tex, col, y * s + j, height);
+                r += p.r;
+                g += p.g;
+                b += p.b;
+            }
+        }
+
+        if (numsamples > 1)
+        {
+            r = (r + numsamples / 2) / numsamples;
+            g = (g + numsamples / 2) / numsamples;
+            b = (b + numsamples / 2) / numsamples;
+        }
+
+        store_observation_pixel(desc.format, r, g, b, &row[x * pixelsize]);
+    }
+}
+
+// Number of rows of an observation whose center sample lies above row sy
+// of its supersampled frame.
+int rows_above(const ObservationDesc& desc, const int sy)
+{
+    const int s = desc.supersampling;
+    return min((sy + s - 1 - s / 2) / s, desc.height);
+}
+
+// Fill column x of the depth, class and cell buffers of an observation from
+// the center sample of every pixel, one run of sky, wall and floor at a time.
+void resolve_observation_labels(
+    const Column* columns,
+    const ObservationDesc& desc,
+    const ObservationBuffers& buffers,
+    const int width, const int height,
+    const int x)
+{
+    const int s = desc.supersampling;
+    const Column& col = columns[x * s + s / 2];
+
+    const int wallstart = rows_above(desc, col.hit ? col.starty : height / 2);
+    const int floorstart = rows_above(desc, col.hit ? col.endy : height / 2);
+
+    if (buffers.depth != nullptr)
+    {
+        float* depth = &buffers.depth[x];
+
+        for (int y = 0; y < wallstart; ++y)
+            depth[y * desc.width] = Infinity;
+
+        for (int y = wallstart; y < floorstart; ++y)
+            depth[y * desc.width] = col.d;
+
+        for (int y = floorstart; y < desc.height; ++y)
+            depth[y * desc.width] = floor_depth(y * s + s / 2, width, height);
+    }
+
+    if (buffers.classes != nullptr)
+    {
+        uint8_t* classes = &buffers.classes[x];
+
+        for (int y = 0; y < wallstart; ++y)
+            classes[y * desc.width] = PixelSky;
+
+        for (int y = wallstart; y < floorstart; ++y)
+            classes[y * desc.width] = PixelWall;
+
+        for (int y = floorstart; y < desc.height; ++y)
+            classes[y * desc.width] = PixelFloor;
+    }
+
+    if (buffers.cells != nullptr)
+    {
+        int* cells = &buffers.cells[x];
+
+        for (int y = 0; y < desc.height; ++y)
+            cells[y * desc.width] = y >= wallstart && y < floorstart ? col.cell : -1;
+    }
+
+    if (buffers.columndepth != nullptr)
+        buffers.columndepth[x] = col.hit ? col.d : Infinity;
+}
+
+// Cast the columns of an observation at its supersampled size into
+// world.columns, then resolve its pixels row by row and its other outputs
+// column by column. Everything runs on the calling worker.
+template <int Mode>
+void render_observation(
+    const Engine& engine,
+    World& world,
+    const FrameState& state,
+    const ObservationDesc& desc,
+    const ObservationBuffers& buffers,
+    FrameProfile* profile,
+    const int worker)
+{
+    TraceScope scope("observation");
+
+    const Texture& tex = wall_texture(engine);
+    uint64_t* times = profile->thread(worker);
+
+    const int s = desc.supersampling;
+    const int width = desc.width * s;
+    const int height = desc.height * s;
+
+    world.columns.resize(width);
+
+    {
+        ScopedTimer timer(&times[StageRayCast]);
+        ScopedCounters counters(profile->thread_counters(worker, StageRayCast));
+        for (int x = 0; x < width; ++x)
+            cast_column(engine, world, state, width, height, x, &world.columns[x]);
+    }
+
+    {
+        ScopedTimer timer(&times[StageWallFill]);
+        ScopedCounters counters(profile->thread_counters(worker, StageWallFill));
+
+        const Column* columns = world.columns.data();
+
+        if (buffers.pixels != nullptr)
+        {
+            for (int y = 0; y < desc.height; ++y)
+                resolve_observation_row<Mode>(tex, columns, desc, height, y, buffers.pixels + static_cast<size_t>(y) * buffers.pitch);
+        }
+
+        if (buffers.depth != nullptr || buffers.classes != nullptr || buffers.cells != nullptr || buffers.columndepth != nullptr)
+        {
+            for (int x = 0; x < desc.width; ++x)
+                resolve_observation_labels(columns, desc, buffers, width, height, x);
+        }
+    }
+}
+
+void render_observation(
+    const Engine& engine,
+    World& world,
+    const FrameState& state,
+    const ObservationDesc& desc,
+    const ObservationBuffers& buffers,
+    FrameProfile* profile,
+    const int worker)
+{
+    switch (wall_mode(state))
+    {
+      case WallFlat: render_observation<WallFlat>(engine, world, state, desc, buffers, profile, worker); break;
+      case WallNearest: render_observation<WallNearest>(engine, world, state, desc, buffers, profile, worker); break;
+      case WallBilinear: render_observation<WallBilinear>(engine, world, state, desc, buffers, profile, worker); break;
+    }
+}
+
+void observe(
+    Engine* engine,
+    World* world,
+    const FrameState& state,
+    const ObservationDesc& desc,
+    const ObservationBuffers& buffers,
+    FrameProfile* profile)
+{
+    myassert(desc.width > 0 && desc.height > 0 && desc.supersampling >= 1);
+    myassert(buffers.pixels == nullptr || buffers.pitch >= desc.width * observation_pixel_size(desc.format));
+
+    engine->streamer.update();
+
+    profile->numthreads = 1;
+
+    {
+        ScopedTimer timer(&profile->stages[StageView]);
+        ScopedCounters counters(profile->counters[StageView]);
+        render_observation(*engine, *world, state, desc, buffers, profile, 0);
+    }
+
+    profile->gather();
+
+    update_minimap_layer(world, state);
+}
+
+// Keep the maximum of every byte of the pixels of two observations in the first one.
+void max_pool_pixels(const ObservationDesc& desc, const uint8_t* other, uint8_t* pixels, const int pitch)
+{
+    const int rowsize = desc.width * observation_pixel_size(desc.format);
+
+    for (int y = 0; y < desc.height; ++y)
+    {
+        const uint8_t* src = other + y * rowsize;
+        uint8_t* dst = pixels + static_cast<size_t>(y) * pitch;
+
+        for (int i = 0; i < rowsize; ++i)
+            dst[i] = max(dst[i], src[i]);
+    }
+}
+
+// Step a world of a batch and render its observation, and the one of the
+// tick before when max pooling.
+void step_and_observe_world(
+    const Engine& engine,
+    const ObservationItem& item,
+    const int numticks,
+    const ObservationDesc& desc,
+    FrameProfile* profile,
+    const int worker)
+{
+    World* world = item.world;
+    const bool maxpool = desc.maxpool && numticks > 1 && item.buffers.pixels != nullptr;
+
+    if (maxpool)
+    {
+        step(world, item.input, numticks - 1);
+
+        const int rowsize = desc.width * observation_pixel_size(desc.format);
+        world->poolpixels.resize(static_cast<size_t>(rowsize) * desc.height);
+
+        ObservationBuffers buffers;
+        memset(&buffers, 0, sizeof(buffers));
+        buffers.pixels = world->poolpixels.data();
+        buffers.pitch = rowsize;
+
+        const FrameState state = capture_frame_state(world, 1.0f);
+        render_observation(engine, *world, state, desc, buffers, profile, worker);
+        update_minimap_layer(world, state);
+
+        // Resets only apply to the first tick.
+        step(world, item.input & ~InputReset, 1);
+    }
+    else step(world, item.input, numticks);
+
+    const FrameState state = capture_frame_state(world, 1.0f);
+    render_observation(engine, *world, state, desc, item.buffers, profile, worker);
+    update_minimap_layer(world, state);
+
+    if (maxpool)
+        max_pool_pixels(desc, world->poolpixels.data(), item.buffers.pixels, item.buffers.pitch);
+}
+
+void step_and_observe(
+    Engine* engine,
+    const ObservationItem* items,
+    const int count,
+    const int numticks,
+    const ObservationDesc& desc,
+    FrameProfile* profile)
+{
+    myassert(desc.width > 0 && desc.height > 0 && desc.supersampling >= 1);
+
+    TraceScope scope("observation batch");
+
+    engine->streamer.update();
+
+    profile->numthreads = engine->pool.thread_count();
+
+    // Observations are small enough that a whole one is the unit of work,
+    // so the world is stepped by the worker that renders it.
+    {
+        ScopedTimer timer(&profile->stages[StageView]);
+        ScopedCounters counters(profile->counters[StageView]);
+
+        engine->pool.parallel_for(count, 1, [engine, items, numticks, &desc, profile](const int begin, const int end, const int worker)
+        {
+            for (int i = begin; i < end; ++i)
+                step_and_observe_world(*engine, items[i], numticks, desc, profile, worker);
+        });
+    }
+
+    profile->gather();
+}
+
+struct SnapshotHeader
+{
+    Player player;
+    Player prevplayer;
+    uint32_t numcells;
+};
+
+void save_snapshot(const World& world, WorldSnapshot* snapshot)
+{
+    const Map& base = *world.basemap;
+    const vector<uint8_t>& cells = world.map.cells;
+
+    // Cells set back to their value in the base map are left out.
+    uint32_t numcells = 0;
+    for (size_t j = 0; j < world.basechanges.size(); ++j)
+    {
+        const int i = world.basechanges[j];
+        if (cells[i] != base.cells[i])
+            ++numcells;
+    }
+
+    snapshot->basemap = world.basemap;
+    snapshot->data.resize(sizeof(SnapshotHeader) + numcells * (sizeof(int32_t) + 1));
+
+    SnapshotHeader header;
+    header.player = world.player;
+    header.prevplayer = world.prevplayer;
+    header.numcells = numcells;
+    memcpy(snapshot->data.data(), &header, sizeof(header));
+
+    uint8_t* indices = snapshot->data.data() + sizeof(SnapshotHeader);
+    uint8_t* values = indices + numcells * sizeof(int32_t);
+
+    for (size_t j = 0; j < world.basechanges.size(); ++j)
+    {
+        const int32_t i = world.basechanges[j];
+        if (cells[i] != base.cells[i])
+        {
+            memcpy(indices, &i, sizeof(i));
+            indices += sizeof(i);
+            *values++ = cells[i];
+        }
+    }
+}
+
+// Set cell i of the map of a world, given as an index into map.cells, and
+// note the change for the minimap if there is one.
+void restore_cell(World* world, const int i, const uint8_t cell)
+{
+    Map& m = world->map;
+    if (m.cells[i] == cell)
+        return;
+
+    m.cells[i] = cell;
+
+    const int ix = i % m.w;
+    const int iy = m.h - 1 - i / m.w;
+    world->mapchanges.push_back(iy * m.w + ix);
+}
+
+void restore_snapshot(World* world, const WorldSnapshot& snapshot)
+{
+    // Never saved.
+    if (snapshot.basemap == nullptr || snapshot.data.size() < sizeof(SnapshotHeader))
+        return;
+
+    SnapshotHeader header;
+    memcpy(&header, snapshot.data.data(), sizeof(header));
+
+    if (world->basemap == snapshot.basemap)
+    {
+        // Undo the changes of the world.
+        const Map& base = *world->basemap;
+        for (size_t j = 0; j < world->basechanges.size(); ++j)
+        {
+            const int i = world->basechanges[j];
+            restore_cell(world, i, base.cells[i]);
+            world->basechanged[i] = 0;
+        }
+
+        world->basechanges.clear();
+    }
+    else
+    {
+        world->map = *snapshot.basemap;
+        world->mapchanges.clear();
+        world->basemap = snapshot.basemap;
+        world->basechanges.clear();
+        world->basechanged.assign(world->map.cells.size(), 0);
+        destroy_minimap_layer(&world->minimaplayer);
+    }
+
+    const uint8_t* indices = snapshot.data.data() + sizeof(SnapshotHeader);
+    const uint8_t* values = indices + header.numcells * sizeof(int32_t);
+
+    for (uint32_t j = 0; j < header.numcells; ++j)
+    {
+        int32_t i;
+        memcpy(&i, indices + j * sizeof(i), sizeof(i));
+
+        restore_cell(world, i, values[j]);
+        world->basechanged[i] = 1;
+        world->basechanges.push_back(i);
+    }
+
+    world->player = header.player;
+    world->prevplayer = header.prevplayer;
+}
+
+void load_map(World* world, const Map& m)
+{
+    world->map = m;
+    world->mapchanges.clear();
+    world->basemap = make_shared<const Map>(m);
+    world->basechanges.clear();
+    world->basechanged.assign(m.cells.size(), 0);
+    destroy_minimap_layer(&world->minimaplayer);
+}
+
+void load_default_map(World* world)
+{
+    Map m;
+    m.w = DefaultMapW;
+    m.h = DefaultMapH;
+    m.cells.assign(DefaultMap, DefaultMap + DefaultMapW * DefaultMapH);
+    load_map(world, m);
+}
+
+bool load_map(World* world, const AssetPack& pack, const char* name)
+{
+    const AssetEntry* entry = pack.find(name, AssetMap);
+    if (entry == nullptr)
+        return false;
+
+    Map m;
+    m.w = static_cast<int>(entry->w);
+    m.h = static_cast<int>(entry->h);
+
+    const uint8_t* cells = pack.data(*entry);
+    m.cells.assign(cells, cells + entry->size);
+
+    if (!is_valid_map(m))
+        return false;
+
+    load_map(world, m);
+
+    return true;
+}
+
+void stream_textures(Engine* engine, const size_t budget)
+{
+    for (int i = 0; i < NumTextures; ++i)
+        free_texture(&engine->textures[i]);
+
+    engine->streamer.start(TextureFilePaths, NumTextures, engine->pack.is_open() ? &engine->pack : nullptr, budget);
+}
+
+void done(Engine* engine)
+{
+    engine->streamer.stop();
+
+    for (int i = 0; i < NumTextures; ++i)
+        free_texture(&engine->textures[i]);
+
+    engine->pack.close();
+}
@@ -0,0 +1,420 @@
+#pragma once
+
+#include "AssetPack.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//
+// Map, simulation and software renderer, with no dependency on SDL.
+//
+// An Engine holds what is shared by every world: textures, which are
+// read-only while a frame renders, and the thread pool. A World holds everything a
+// single simulation owns, so that a process can run many of them side by
+// side. A world must only be stepped and rendered by one thread at a time,
+// and an engine must only render one frame at a time.
+//
+
+#define FLIP
+
+const int ScreenWidth = 1280;
+const int ScreenHeight = 720;
+
+#ifdef NDEBUG
+#define myassert(cond)
+#else
+#define myassert(cond) if (!(cond)) { __debugbreak(); }
+#endif
+
+const float Pi = 3.1415926535897932f;
+const float Infinity = 1.0e20f;
+
+inline float dtor(float d)
+{
+    return d * Pi / 180.0f;
+}
+
+struct ScreenPixel
+{
+    uint8_t b;
+    uint8_t g;
+    uint8_t r;
+    uint8_t a;
+};
+
+ScreenPixel rgb(uint8_t r, uint8_t g, uint8_t b);
+
+// Pixel (x, y) of a framebuffer, with (0,0) at top left, whatever its layout.
+ScreenPixel getpix(const ScreenPixel* pixels, const int x, const int y);
+
+// Grid of cells, 0 for empty and anything else for a wall. The outermost
+// cells must be walls.
+struct Map
+{
+    int w, h;
+    std::vector<uint8_t> cells;     // top row first
+};
+
+// Whether a map has walls all around and an empty player start cell.
+bool is_valid_map(const Map& m);
+
+// Fill a map of the given size with walls on its border and inside at
+// random with the given probability, keeping the player start cell empty.
+void generate_map(const int w, const int h, const float density, const uint32_t seed, Map* m);
+
+// Cell at (ix, iy) of a map, with (0,0) at bottom left; walls outside of it.
+uint8_t safemap(const Map& m, const int ix, const int iy);
+uint8_t map(const Map& m, const int ix, const int iy);
+
+const float HFov = dtor(90.0f);
+const float VFov = HFov * ScreenHeight / ScreenWidth;
+const float FilmWidth = 0.01f;
+const float FilmHeight = FilmWidth * ScreenHeight / ScreenWidth;
+const float FocalLength = FilmWidth / 2.0f * std::tan(HFov / 2.0f);
+const float WallHeight = 1.0f;
+const float WallPadding = 0.1f;
+
+// Simulation ticks per second.
+const float DefaultTickRate = 60.0f;
+
+// Bound on the ticks simulated per rendered frame, to recover from stalls
+// instead of falling further and further behind.
+const int MaxTicksPerFrame = 8;
+
+// Minimap cell size in pixels, doubled or halved when zooming.
+const int DefaultMinimapCellSize = 40;
+const int MinMinimapCellSize = 5;
+const int MaxMinimapCellSize = 80;
+
+enum InputBits
+{
+    InputLeft       = 1 << 0,
+    InputRight      = 1 << 1,
+    InputForward    = 1 << 2,
+    InputBackward   = 1 << 3,
+    InputRun        = 1 << 4,
+    InputStrafe     = 1 << 5,
+    InputReset      = 1 << 6    // move the player back to the start before the tick
+};
+
+struct Player
+{
+    float x, y, a;
+
+    void reset()
+    {
+        x = 2.0f;
+        y = 2.0f;
+        a = dtor(90.0f);
+    }
+};
+
+struct Texture
+{
+    int w, h, n;
+    const uint8_t* data;    // w x h RGBA texels, top row first
+    uint8_t* pixels;        // decoded image, when the texels are not mapped from a cache
+    MappedFile cache;
+};
+
+// Load an image file as RGBA, replacing any previous image. The texels are
+// mapped from the cache of the image when it is up to date, and the image
+// is decoded and its cache written otherwise. Without the image, an
+// existing cache is used as it is.
+bool load_texture(Texture* tex, const char* filepath);
+
+// Load the texture packed as name, reading its texels in place.
+bool load_texture(Texture* tex, const AssetPack& pack, const char* name);
+
+void free_texture(Texture* tex);
+
+const int NumTextures = 1;
+
+// Names of the default textures, as files relative to the working directory
+// and as assets in packs.
+extern const char* TextureFilePaths[NumTextures];
+
+// Name of the built-in level in packs.
+extern const char* DefaultMapAsset;
+
+struct Engine
+{
+    ThreadPool pool;
+    Texture textures[NumTextures];
+    AssetPack pack;
+    TextureStreamer streamer;       // replaces textures once started
+};
+
+// Load the default textures from the working directory and return whether
+// they all loaded; the thread pool is started separately.
+bool init(Engine* engine);
+
+// Same, reading the default textures in place from an asset pack, which the
+// engine keeps open until done(). Returns false if the pack cannot be opened
+// or lacks a texture.
+bool init(Engine* engine, const char* packpath);
+void done(Engine* engine);
+
+// Stream the default textures instead of keeping them loaded, from the pack
+// of the engine if it is open and from the working directory otherwise, with
+// at most budget bytes of texels resident. Frames never wait for textures
+// and draw the average color of the ones still loading.
+void stream_textures(Engine* engine, const size_t budget);
+
+// What the wall occupying a screen column looks like.
+struct Column
+{
+    bool hit;
+    int cell;       // iy * map.w + ix
+    float d;
+    float shade;
+    float rcpwallheight;
+    int wallstarty;
+    int starty, endy;
+    int iu;
+    float fu;
+};
+
+enum WallMode
+{
+    WallFlat,
+    WallNearest,
+    WallBilinear
+};
+
+// Static part of the minimap, rasterized once and patched when cells change.
+// Stored in the framebuffer layout, top row first.
+struct MinimapLayer
+{
+    int cellsize;
+    int w, h;
+    ScreenPixel* pixels;
+};
+
+struct World
+{
+    Map map;
+    std::vector<int> mapchanges;    // cells changed since the last captured frame, as iy * map.w + ix
+
+    std::shared_ptr<const Map> basemap;     // map as loaded, shared with snapshots
+    std::vector<int> basechanges;           // cells set since the map was loaded, as indices into map.cells
+    std::vector<uint8_t> basechanged;       // whether every cell is in basechanges
+
+    Player player;
+    Player prevplayer;              // player before the last tick, for interpolation
+    float tickrate;
+
+    bool texture;
+    bool bilinear;
+    bool minimap;
+    int minimapcellsize;
+
+    MinimapLayer minimaplayer;
+    std::vector<Column> columns;    // screen columns of the last frame, when filling row by row or observing
+    std::vector<uint8_t> poolpixels;    // pixels of the next to last observation, when max pooling
+
+    // Start on the built-in map with the default settings.
+    World();
+    ~World();
+
+  private:
+    World(const World&);
+    World& operator=(const World&);
+};
+
+// Make the built-in level the map of a world.
+void load_default_map(World* world);
+
+// Make the map packed as name the map of a world, if there is a valid one.
+bool load_map(World* world, const AssetPack& pack, const char* name);
+
+// Make a copy of m the map of a world, dropping anything derived from the previous one.
+void load_map(World* world, const Map& m);
+
+void setmap(World* world, const int ix, const int iy, const uint8_t cell);
+
+// State of a world at some point of a simulation: the player and the cells
+// that differ from the map as loaded, which is shared rather than copied.
+// Settings such as the tick rate and the render flags are not part of it.
+struct WorldSnapshot
+{
+    std::shared_ptr<const Map> basemap;
+    std::vector<uint8_t> data;      // SnapshotHeader, then the index into map.cells of every changed cell, then their values
+};
+
+// Capture the state of a world, reusing the memory of the snapshot. Takes
+// time proportional to the number of cells set since the map was loaded.
+void save_snapshot(const World& world, WorldSnapshot* snapshot);
+
+// Put a world, the one the snapshot was taken from or any other, back in the
+// state of a snapshot. Takes time proportional to the number of cells
+// changed in the world and in the snapshot when the world is on the same
+// map as loaded, which is the case once it has been restored from a
+// snapshot of that map; otherwise the whole map is copied. Restoring a
+// snapshot that was never saved leaves the world as it is.
+void restore_snapshot(World* world, const WorldSnapshot& snapshot);
+
+// Immutable copy of everything rendering a frame needs, captured once the
+// simulation of that frame is done.
+struct FrameState
+{
+    Player player;
+    bool texture;
+    bool bilinear;
+    bool minimap;
+    int minimapcellsize;
+    std::vector<int> mapchanges;
+};
+
+FrameState capture_frame_state(World* world, const float alpha);
+
+// Walk a map from (x0, y0) towards (x1, y1) and return the first wall hit,
+// with u the position of the hit along the wall face.
+bool cast_ray(
+    const Map& m,
+    const float x0, const float y0,
+    const float x1, const float y1,
+    float* hx, float* hy,
+    float* u);
+
+// Same, also returning the wall cell hit as iy * m.w + ix.
+bool cast_ray(
+    const Map& m,
+    const float x0, const float y0,
+    const float x1, const float y1,
+    float* hx, float* hy,
+    float* u,
+    int* cell);
+
+// Move the player of a world by one tick of dt seconds, sliding along walls.
+void update(World* world, const uint32_t input, const float dt);
+
+// Advance a world by a number of fixed ticks with the same input. A reset
+// only applies before the first tick.
+void step(World* world, const uint32_t input, const int numticks);
+
+void reset_player(World* world);
+
+// Set up a column for a wall at perpendicular distance d, hit at u along its face.
+void project_column(const Texture& tex, const float d, const float u, const bool bilinear, Column* col);
+
+// Same for a frame of the given size in pixels.
+void project_column(
+    const Texture& tex,
+    const float d, const float u,
+    const bool bilinear,
+    const int width, const int height,
+    Column* col);
+
+// Fill the sky and the floor of a screen column; used when the framebuffer is column-major.
+void fill_sky_floor(const Column& col, ScreenPixel* pixels, const int x);
+
+// Fill the wall of a screen column.
+template <int Mode>
+void fill_wall(const Texture& tex, const Column& col, ScreenPixel* pixels, const int x);
+
+// Fill a band of screen rows from precomputed columns; used when the
+// framebuffer is row-major.
+template <int Mode>
+void fill_rows(const Texture& tex, const Column* columns, ScreenPixel* pixels, const int begin, const int end);
+
+// Render a frame of a world and record its timings into profile.
+void render(Engine* engine, World* world, const FrameState& state, ScreenPixel* pixels, FrameProfile* profile);
+
+// One world of a batch, with the input held during its next ticks and the
+// framebuffer its frame goes to.
+struct BatchItem
+{
+    World* world;
+    uint32_t input;
+    ScreenPixel* pixels;
+};
+
+// Step every world of a batch by numticks ticks and render its frame, with
+// no interpolation. The frames are rendered together, in a single pool
+// dispatch, and the timings of the whole batch are recorded into profile.
+// The worlds must be distinct.
+void step_and_render(Engine* engine, const BatchItem* items, const int count, const int numticks, FrameProfile* profile);
+
+// Layout of the pixels of an observation.
+enum ObservationFormat
+{
+    ObservationBGRA8,       // same as ScreenPixel
+    ObservationGray8,       // luma
+    ObservationRed8,
+    ObservationGreen8,
+    ObservationBlue8
+};
+
+int observation_pixel_size(const ObservationFormat format);
+
+// What a pixel of an observation shows.
+enum PixelClass
+{
+    PixelSky,
+    PixelFloor,
+    PixelWall
+};
+
+// A view rendered for an agent rather than for display, directly at its own
+// size. Pixels are square and the horizontal field of view is HFov at any
+// size, so the vertical field of view follows the aspect ratio. With
+// supersampling n, every pixel averages n rays by n rows.
+struct ObservationDesc
+{
+    int width, height;
+    int supersampling;
+    ObservationFormat format;
+    bool maxpool;           // when stepping several ticks, the pixels are the maximum of the last two frames
+};
+
+// Outputs of an observation, top row first; any of them may be null. Depth
+// is the distance along the view direction, Infinity for the sky. With
+// supersampling, everything but the colors is taken from the sample at the
+// center of each pixel.
+struct ObservationBuffers
+{
+    uint8_t* pixels;
+    int pitch;              // bytes from a row of pixels to the next
+    float* depth;           // width x height
+    uint8_t* classes;       // width x height PixelClass values
+    int* cells;             // width x height, wall cell as iy * map.w + ix, -1 for the sky and floor
+    float* columndepth;     // width, distance of the wall seen by every column
+};
+
+// Render an observation of a world on the calling thread. The minimap is
+// never drawn.
+void observe(
+    Engine* engine,
+    World* world,
+    const FrameState& state,
+    const ObservationDesc& desc,
+    const ObservationBuffers& buffers,
+    FrameProfile* profile);
+
+// One world of a batch of observations.
+struct ObservationItem
+{
+    World* world;
+    uint32_t input;
+    ObservationBuffers buffers;
+};
+
+// Step every world of a batch by numticks ticks and render its observation,
+// with no interpolation; the ticks in between are simulated but not
+// rendered. With max pooling and more than one tick, the next to last tick
+// is rendered too, and the pixels are the maximum of both frames. Every
+// world is stepped and observed by one worker; both are timed as the view.
+void step_and_observe(
+    Engine* engine,
+    const ObservationItem* items,
+    const int count,
+    const int numticks,
+    const ObservationDesc& desc,
+    FrameProfile* profile);
@@ -0,0 +1,316 @@
+#include "FrameRing.h"
+
+#include <cstring>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static_assert(sizeof(FrameRingHeader) <= FrameRingAlignment, "the header of a frame ring must fit in a cache line");
+static_assert(sizeof(FrameRingSlot) <= FrameRingSlotPixelsOffset, "the header of a slot must fit before its pixels");
+
+namespace
+{
+    const char Magic[4] = { 'W', 'R', 'N', 'G' };
+
+    size_t align(const size_t size)
+    {
+        return (size + FrameRingAlignment - 1) & ~(FrameRingAlignment - 1);
+    }
+
+#if !defined(_WIN32)
+    // POSIX shared memory object names start with a slash.
+    string shm_name(const char* name)
+    {
+        return name[0] == '/' ? string(name) : string("/") + name;
+    }
+#endif
+}
+
+FrameRing::FrameRing()
+  : m_base(nullptr)
+  , m_size(0)
+  , m_writer(false)
+  , m_next(0)
+#if defined(_WIN32)
+  , m_mapping(nullptr)
+#endif
+{
+}
+
+FrameRing::~FrameRing()
+{
+    close();
+}
+
+bool FrameRing::create(
+    const char* name,
+    const int numslots,
+    const int width,
+    const int height,
+    const ObservationFormat format,
+    const bool columnmajor)
+{
+    close();
+
+    if (numslots < 1 || width < 1 || height < 1)
+        return false;
+
+    const size_t pixelsize = observation_pixel_size(format);
+    const size_t pitch = (columnmajor ? height : width) * pixelsize;
+    const size_t slotsize = align(FrameRingSlotPixelsOffset + pitch * (columnmajor ? width : height));
+
+    if (slotsize > UINT32_MAX)
+        return false;
+
+    if (!map(name, FrameRingAlignment + slotsize * numslots, true))
+        return false;
+
+    // The mapping starts zeroed, so no frame is published and every sequence is 0.
+    FrameRingHeader* header = reinterpret_cast<FrameRingHeader*>(m_base);
+    header->version = FrameRingVersion;
+    header->numslots = numslots;
+    header->slotsize = static_cast<uint32_t>(slotsize);
+    header->width = width;
+    header->height = height;
+    header->format = format;
+    header->pitch = static_cast<uint32_t>(pitch);
+    header->columnmajor = columnmajor ? 1 : 0;
+
+    // Consumers check the magic first; make it visible last.
+    atomic_thread_fence(memory_order_release);
+    memcpy(header->magic, Magic, sizeof(Magic));
+
+    m_next = 0;
+
+    return true;
+}
+
+bool FrameRing::open(const char* name)
+{
+    close();
+
+    if (!map(name, 0, false))
+        return false;
+
+    const FrameRingHeader& h = header();
+    bool valid =
+        m_size >= sizeof(FrameRingHeader) &&
+        memcmp(h.magic, Magic, sizeof(Magic)) == 0;
+
+    // The rest of the header was written before the magic.
+    atomic_thread_fence(memory_order_acquire);
+
+    // Consumers read frames as the header describes them, so it must match
+    // what the slots can hold.
+    valid =
+        valid &&
+        h.version == FrameRingVersion &&
+        h.numslots > 0 &&
+        h.width > 0 &&
+        h.height > 0 &&
+        h.format <= static_cast<uint32_t>(ObservationBlue8) &&
+        h.columnmajor <= 1 &&
+        h.pitch >= static_cast<uint64_t>(h.columnmajor != 0 ? h.height : h.width) * observation_pixel_size(static_cast<ObservationFormat>(h.format)) &&
+        h.slotsize >= FrameRingSlotPixelsOffset + static_cast<uint64_t>(h.pitch) * (h.columnmajor != 0 ? h.width : h.height) &&
+        m_size >= FrameRingAlignment + static_cast<uint64_t>(h.slotsize) * h.numslots;
+
+    if (!valid)
+        close();
+
+    return valid;
+}
+
+void FrameRing::close()
+{
+    if (m_base == nullptr)
+        return;
+
+#if defined(_WIN32)
+    UnmapViewOfFile(m_base);
+    CloseHandle(m_mapping);
+    m_mapping = nullptr;
+#else
+    munmap(m_base, m_size);
+
+    // Consumers keep their mappings; new ones can no longer find the ring.
+    if (m_writer)
+        shm_unlink(m_name.c_str());
+#endif
+
+    m_base = nullptr;
+    m_size = 0;
+    m_writer = false;
+    m_name.clear();
+}
+
+bool FrameRing::is_open() const
+{
+    return m_base != nullptr;
+}
+
+bool FrameRing::is_writer() const
+{
+    return m_writer;
+}
+
+const FrameRingHeader& FrameRing::header() const
+{
+    myassert(is_open());
+    return *reinterpret_cast<const FrameRingHeader*>(m_base);
+}
+
+uint8_t* FrameRing::begin_frame()
+{
+    myassert(m_writer);
+
+    FrameRingSlot* s = slot(m_next);
+    s->sequence.store(2 * m_next + 1, memory_order_relaxed);
+
+    // Keep the pixels from becoming visible before the slot is marked.
+    atomic_thread_fence(memory_order_release);
+
+    return reinterpret_cast<uint8_t*>(s) + FrameRingSlotPixelsOffset;
+}
+
+void FrameRing::end_frame()
+{
+    myassert(m_writer);
+
+    slot(m_next)->sequence.store(2 * m_next + 2, memory_order_release);
+    ++m_next;
+
+    FrameRingHeader* h = reinterpret_cast<FrameRingHeader*>(m_base);
+    h->published.store(m_next, memory_order_release);
+}
+
+uint64_t FrameRing::published() const
+{
+    return header().published.load(memory_order_acquire);
+}
+
+const uint8_t* FrameRing::read_frame(const uint64_t n) const
+{
+    const FrameRingSlot* s = slot(n);
+    if (s->sequence.load(memory_order_acquire) != 2 * n + 2)
+        return nullptr;
+
+    return reinterpret_cast<const uint8_t*>(s) + FrameRingSlotPixelsOffset;
+}
+
+bool FrameRing::is_intact(const uint64_t n) const
+{
+    // Keep the reads of the pixels from moving past the check.
+    atomic_thread_fence(memory_order_acquire);
+    return slot(n)->sequence.load(memory_order_relaxed) == 2 * n + 2;
+}
+
+FrameRingSlot* FrameRing::slot(const uint64_t n) const
+{
+    const FrameRingHeader& h = header();
+    return reinterpret_cast<FrameRingSlot*>(m_base + FrameRingAlignment + (n % h.numslots) * h.slotsize);
+}
+
+bool FrameRing::map(const char* name, const size_t size, const bool writer)
+{
+#if defined(_WIN32)
+    HANDLE mapping;
+    if (writer)
+    {
+        const uint64_t size64 = size;
+        mapping =
+            CreateFileMappingA(
+                INVALID_HANDLE_VALUE,
+                nullptr,
+                PAGE_READWRITE,
+                static_cast<DWORD>(size64 >> 32),
+                static_cast<DWORD>(size64),
+                name);
+
+        // An existing mapping keeps its size and contents.
+        if (mapping != nullptr && GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            CloseHandle(mapping);
+            return false;
+        }
+    }
+    else mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+
+    if (mapping == nullptr)
+        return false;
+
+    void* base = MapViewOfFile(mapping, writer ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+    if (base == nullptr)
+    {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    // Readers see the size of the view rounded up to pages.
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery(base, &info, sizeof(info));
+
+    m_mapping = mapping;
+    m_base = static_cast<uint8_t*>(base);
+    m_size = writer ? size : info.RegionSize;
+#else
+    const string path = shm_name(name);
+
+    int fd;
+    if (writer)
+    {
+        // Start from a fresh object so that consumers still mapping an old one are unaffected.
+        shm_unlink(path.c_str());
+        fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            ::close(fd);
+            shm_unlink(path.c_str());
+            return false;
+        }
+    }
+    else fd = shm_open(path.c_str(), O_RDONLY, 0);
+
+    if (fd < 0)
+        return false;
+
+    size_t mapsize = size;
+    if (!writer)
+    {
+        struct stat st;
+        mapsize = fstat(fd, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+    }
+
+    void* base =
+        mapsize > 0
+            ? mmap(nullptr, mapsize, writer ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0)
+            : MAP_FAILED;
+
+    // The mapping stays valid once the descriptor is closed.
+    ::close(fd);
+
+    if (base == MAP_FAILED)
+    {
+        if (writer)
+            shm_unlink(path.c_str());
+        return false;
+    }
+
+    m_base = static_cast<uint8_t*>(base);
+    m_size = mapsize;
+    m_name = path;
+#endif
+
+    m_writer = writer;
+
+    return true;
+}
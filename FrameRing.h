@@ -0,0 +1,116 @@
+#pragma once
+
+#include "Engine.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//
+// Ring of frames in shared memory, for consumers in other processes to read
+// what the engine renders in place, without copying it out. The producer
+// renders straight into the slot of the next frame and publishes it; it
+// never waits for consumers, so frame n overwrites frame n - numslots.
+// Consumers detect overwritten frames with the sequence number of every
+// slot, like a seqlock.
+//
+// The shared memory object holds a FrameRingHeader followed by numslots
+// slots of slotsize bytes, each one a FrameRingSlot followed by the pixels at
+// FrameRingSlotPixelsOffset.
+//
+// Frame n, counting from 0, goes to slot n % numslots:
+// - The producer sets the sequence of the slot to 2n + 1, writes the pixels,
+//   sets the sequence to 2n + 2, then sets published to n + 1.
+// - A consumer reads published, picks a frame n below it, checks that the
+//   sequence of its slot is 2n + 2, reads the pixels in place, then checks
+//   that the sequence is still 2n + 2. If it is not, the frame was
+//   overwritten while being read and what was read must be discarded.
+//
+
+struct FrameRingHeader
+{
+    char magic[4];                      // "WRNG"
+    uint32_t version;
+    uint32_t numslots;
+    uint32_t slotsize;                  // bytes from a slot to the next
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;                    // ObservationFormat of the pixels
+    uint32_t pitch;                     // bytes from a row of pixels to the next, or from a column to the next if column major
+    uint32_t columnmajor;               // 1 for frames in the FLIP framebuffer layout, left column first
+    uint32_t reserved;
+    std::atomic<uint64_t> published;    // number of frames published so far
+};
+
+struct FrameRingSlot
+{
+    std::atomic<uint64_t> sequence;     // 0 until the first frame, then 2n + 1 while frame n is written and 2n + 2 once it is published
+};
+
+const uint32_t FrameRingVersion = 1;
+
+// Slots and their pixels start on cache line boundaries.
+const size_t FrameRingAlignment = 64;
+const size_t FrameRingSlotPixelsOffset = FrameRingAlignment;
+
+class FrameRing
+{
+  public:
+    FrameRing();
+    ~FrameRing();
+
+    // Create the shared memory object name with numslots slots of width x
+    // height pixels and open it for writing. A previous ring of the same name
+    // is replaced on POSIX systems; on Windows, creation fails while it is
+    // still open anywhere.
+    bool create(
+        const char* name,
+        const int numslots,
+        const int width,
+        const int height,
+        const ObservationFormat format,
+        const bool columnmajor);
+
+    // Open an existing ring for reading.
+    bool open(const char* name);
+
+    // Unmap the ring; the producer also removes its name.
+    void close();
+
+    bool is_open() const;
+    bool is_writer() const;
+
+    const FrameRingHeader& header() const;
+
+    // Producer: pixels of the next frame, to render into, then publish them.
+    // The slot counts as being written from begin_frame() on.
+    uint8_t* begin_frame();
+    void end_frame();
+
+    // Consumer: number of frames published so far.
+    uint64_t published() const;
+
+    // Consumer: pixels of frame n in place, or null if it was not published
+    // yet or has already been overwritten. Once done with them, is_intact()
+    // tells whether they were overwritten in the meantime.
+    const uint8_t* read_frame(const uint64_t n) const;
+    bool is_intact(const uint64_t n) const;
+
+  private:
+    uint8_t* m_base;
+    size_t m_size;
+    bool m_writer;
+    uint64_t m_next;            // next frame to write
+    std::string m_name;
+#if defined(_WIN32)
+    void* m_mapping;
+#endif
+
+    FrameRingSlot* slot(const uint64_t n) const;
+
+    bool map(const char* name, const size_t size, const bool writer);
+
+    FrameRing(const FrameRing&);
+    FrameRing& operator=(const FrameRing&);
+};
@@ -0,0 +1,320 @@
+#include "Golden.h"
+
+#include "Engine.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    struct GoldenMap
+    {
+        const char* name;
+        int size;           // 0 for the built-in map
+        float density;
+        uint32_t seed;
+    };
+
+    const GoldenMap GoldenMaps[] =
+    {
+        { "default", 0, 0.0f, 0 },
+        { "sparse", 32, 0.05f, 7 },
+        { "dense", 16, 0.35f, 11 }
+    };
+
+    const int NumGoldenMaps = sizeof(GoldenMaps) / sizeof(GoldenMaps[0]);
+
+    // The last pose of every map also shows the minimap.
+    const int PosesPerMap = 4;
+
+    // Poses in the built-in map, in degrees, showing near, far and oblique walls.
+    const float DefaultPoses[PosesPerMap][3] =
+    {
+        { 2.0f, 2.0f, 90.0f },
+        { 1.5f, 6.3f, -30.0f },
+        { 4.5f, 3.5f, 200.0f },
+        { 6.2f, 1.4f, 135.0f }
+    };
+
+    struct Image
+    {
+        int w, h;
+        vector<uint8_t> rgb;
+    };
+
+    void golden_poses(const GoldenMap& gm, const Map& m, Player poses[PosesPerMap])
+    {
+        if (gm.size == 0)
+        {
+            for (int i = 0; i < PosesPerMap; ++i)
+            {
+                poses[i].x = DefaultPoses[i][0];
+                poses[i].y = DefaultPoses[i][1];
+                poses[i].a = dtor(DefaultPoses[i][2]);
+            }
+            return;
+        }
+
+        // Random poses in empty cells, clear of the wall padding.
+        uint32_t state = gm.seed;
+        int i = 0;
+        while (i < PosesPerMap)
+        {
+            uint32_t r[4];
+            for (int j = 0; j < 4; ++j)
+            {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                r[j] = state;
+            }
+
+            const int ix = static_cast<int>(r[0] % m.w);
+            const int iy = static_cast<int>(r[1] % m.h);
+            if (map(m, ix, iy) != 0)
+                continue;
+
+            poses[i].x = ix + 0.2f + 0.6f * static_cast<float>(r[2] >> 8) / 16777216.0f;
+            poses[i].y = iy + 0.2f + 0.6f * static_cast<float>(r[3] >> 8) / 16777216.0f;
+            poses[i].a = dtor(static_cast<float>(i * 97 % 360));
+            ++i;
+        }
+    }
+
+    void capture_image(const ScreenPixel* pixels, Image* image)
+    {
+        image->w = ScreenWidth;
+        image->h = ScreenHeight;
+        image->rgb.resize(ScreenWidth * ScreenHeight * 3);
+
+        for (int y = 0; y < ScreenHeight; ++y)
+        {
+            for (int x = 0; x < ScreenWidth; ++x)
+            {
+                const ScreenPixel p = getpix(pixels, x, y);
+                uint8_t* out = &image->rgb[(y * ScreenWidth + x) * 3];
+                out[0] = p.r;
+                out[1] = p.g;
+                out[2] = p.b;
+            }
+        }
+    }
+
+    bool write_ppm(const char* filepath, const Image& image)
+    {
+        FILE* file = fopen(filepath, "wb");
+        if (file == nullptr)
+            return false;
+
+        fprintf(file, "P6\n%d %d\n255\n", image.w, image.h);
+        fwrite(image.rgb.data(), 1, image.rgb.size(), file);
+
+        return fclose(file) == 0;
+    }
+
+    bool read_ppm(const char* filepath, Image* image)
+    {
+        FILE* file = fopen(filepath, "rb");
+        if (file == nullptr)
+            return false;
+
+        int maxval;
+        const bool valid =
+            fscanf(file, "P6 %d %d %d", &image->w, &image->h, &maxval) == 3 &&
+            maxval == 255 &&
+            image->w > 0 && image->h > 0 &&
+            fgetc(file) != EOF;
+
+        if (valid)
+        {
+            image->rgb.resize(image->w * image->h * 3);
+            const size_t size = fread(image->rgb.data(), 1, image->rgb.size(), file);
+            fclose(file);
+            return size == image->rgb.size();
+        }
+
+        fclose(file);
+        return false;
+    }
+
+    // Count the pixels that differ by more than tolerance in any channel.
+    // The diff image shows them in red over a darkened copy of the reference.
+    int compare_images(const Image& expected, const Image& actual, const int tolerance, int* maxdiff, Image* diff)
+    {
+        diff->w = expected.w;
+        diff->h = expected.h;
+        diff->rgb.resize(expected.rgb.size());
+
+        int numdiffs = 0;
+        *maxdiff = 0;
+
+        for (size_t i = 0; i < expected.rgb.size(); i += 3)
+        {
+            int d = 0;
+            for (int c = 0; c < 3; ++c)
+                d = max(d, abs(expected.rgb[i + c] - actual.rgb[i + c]));
+
+            *maxdiff = max(*maxdiff, d);
+
+            if (d > tolerance)
+            {
+                diff->rgb[i + 0] = 255;
+                diff->rgb[i + 1] = 0;
+                diff->rgb[i + 2] = 0;
+                ++numdiffs;
+            }
+            else
+            {
+                for (int c = 0; c < 3; ++c)
+                    diff->rgb[i + c] = expected.rgb[i + c] / 4;
+            }
+        }
+
+        return numdiffs;
+    }
+
+    // Render every golden image and pass it along with its name to visit.
+    // Renders nothing and returns false if the default textures are missing.
+    template <typename Visitor>
+    bool render_golden_images(const int numthreads, Visitor visit)
+    {
+        Engine engine;
+        if (!init(&engine))
+        {
+            fprintf(stderr, "Failed to load the default textures; run from the repository root\n");
+            done(&engine);
+            return false;
+        }
+
+        engine.pool.start(numthreads);
+
+        World world;
+
+        ScreenPixel* pixels = new ScreenPixel[ScreenWidth * ScreenHeight];
+        FrameProfile* profile = new FrameProfile();
+        Image image;
+
+        for (int i = 0; i < NumGoldenMaps; ++i)
+        {
+            const GoldenMap& gm = GoldenMaps[i];
+
+            if (gm.size == 0)
+                load_default_map(&world);
+            else
+            {
+                Map m;
+                generate_map(gm.size, gm.size, gm.density, gm.seed, &m);
+                load_map(&world, m);
+            }
+
+            Player poses[PosesPerMap];
+            golden_poses(gm, world.map, poses);
+
+            for (int p = 0; p < PosesPerMap; ++p)
+            {
+                for (int mode = 0; mode < 4; ++mode)
+                {
+                    FrameState state;
+                    state.player = poses[p];
+                    state.texture = (mode & 1) != 0;
+                    state.bilinear = (mode & 2) != 0;
+                    state.minimap = p == PosesPerMap - 1;
+                    state.minimapcellsize = DefaultMinimapCellSize;
+
+                    profile->clear();
+                    render(&engine, &world, state, pixels, profile);
+                    capture_image(pixels, &image);
+
+                    char name[64];
+                    sprintf(name, "%s_p%d_t%d_b%d", gm.name, p, state.texture ? 1 : 0, state.bilinear ? 1 : 0);
+                    visit(name, image);
+                }
+            }
+        }
+
+        delete profile;
+        delete[] pixels;
+        engine.pool.stop();
+        done(&engine);
+
+        return true;
+    }
+}
+
+int check_golden_images(const char* directory, const int tolerance, const int numthreads)
+{
+    int numimages = 0;
+    int numfailures = 0;
+
+    const bool rendered = render_golden_images(numthreads, [directory, tolerance, &numimages, &numfailures](const char* name, const Image& actual)
+    {
+        ++numimages;
+
+        const string basepath = string(directory) + "/" + name;
+
+        Image expected;
+        if (!read_ppm((basepath + ".ppm").c_str(), &expected))
+        {
+            printf("FAIL %s: missing or invalid reference image\n", name);
+            ++numfailures;
+            return;
+        }
+
+        if (expected.w != actual.w || expected.h != actual.h)
+        {
+            printf("FAIL %s: reference image is %dx%d\n", name, expected.w, expected.h);
+            ++numfailures;
+            return;
+        }
+
+        int maxdiff;
+        Image diff;
+        const int numdiffs = compare_images(expected, actual, tolerance, &maxdiff, &diff);
+
+        if (numdiffs == 0)
+        {
+            printf("ok   %s (max difference %d)\n", name, maxdiff);
+            return;
+        }
+
+        printf("FAIL %s: %d pixels differ by more than %d (max difference %d)\n", name, numdiffs, tolerance, maxdiff);
+        ++numfailures;
+
+        if (!write_ppm((basepath + ".actual.ppm").c_str(), actual) ||
+            !write_ppm((basepath + ".diff.ppm").c_str(), diff))
+            fprintf(stderr, "Failed to write the actual and diff images of %s\n", name);
+    });
+
+    if (!rendered)
+        return 1;
+
+    printf("%d of %d images differ\n", numfailures, numimages);
+
+    return numfailures;
+}
+
+int update_golden_images(const char* directory, const int numthreads)
+{
+    int numfailures = 0;
+
+    const bool rendered = render_golden_images(numthreads, [directory, &numfailures](const char* name, const Image& image)
+    {
+        const string filepath = string(directory) + "/" + name + ".ppm";
+
+        if (write_ppm(filepath.c_str(), image))
+            printf("Wrote %s\n", filepath.c_str());
+        else
+        {
+            fprintf(stderr, "Failed to write %s\n", filepath.c_str());
+            ++numfailures;
+        }
+    });
+
+    return rendered ? numfailures : 1;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+//
+// Golden-image regression checks. A fixed set of camera poses over several
+// maps is rendered with every combination of texturing and bilinear
+// filtering, and compared with reference images stored as binary PPM files.
+// Images are stored top row first whatever the framebuffer layout, so that
+// builds with and without FLIP check against the same references.
+//
+
+// Compare every golden image with its reference in directory, allowing a
+// difference of up to tolerance per color channel, and write NAME.actual.ppm
+// and NAME.diff.ppm next to the reference of every image that differs.
+// Returns the number of failed images, or 1 if the default textures are
+// missing.
+int check_golden_images(const char* directory, const int tolerance, const int numthreads);
+
+// Render every golden image into directory, replacing the references.
+// Returns the number of images that could not be written, or 1, writing
+// nothing, if the default textures are missing.
+int update_golden_images(const char* directory, const int numthreads);
@@ -0,0 +1,90 @@
+#include "InputRecording.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+    const char Magic[4] = { 'W', 'I', 'N', 'P' };
+}
+
+bool load_input_recording(const char* filepath, InputRecording* recording)
+{
+    FILE* file = fopen(filepath, "rb");
+    if (file == nullptr)
+        return false;
+
+    InputRecordingHeader header;
+    bool valid =
+        fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, Magic, sizeof(Magic)) == 0 &&
+        header.version == InputRecordingVersion &&
+        header.tickrate > 0.0f;
+
+    if (valid)
+    {
+        recording->tickrate = header.tickrate;
+        recording->inputs.resize(header.numticks);
+        valid = header.numticks == 0 || fread(recording->inputs.data(), header.numticks, 1, file) == 1;
+    }
+
+    fclose(file);
+
+    return valid;
+}
+
+InputRecorder::InputRecorder()
+  : m_file(nullptr)
+{
+}
+
+InputRecorder::~InputRecorder()
+{
+    close();
+}
+
+bool InputRecorder::open(const char* filepath, const float tickrate)
+{
+    close();
+
+    m_file = fopen(filepath, "wb");
+    if (m_file == nullptr)
+        return false;
+
+    memcpy(m_header.magic, Magic, sizeof(Magic));
+    m_header.version = InputRecordingVersion;
+    m_header.tickrate = tickrate;
+    m_header.numticks = 0;
+
+    return fwrite(&m_header, sizeof(m_header), 1, m_file) == 1;
+}
+
+bool InputRecorder::is_open() const
+{
+    return m_file != nullptr;
+}
+
+void InputRecorder::record(const uint32_t input)
+{
+    if (m_file == nullptr)
+        return;
+
+    fputc(static_cast<int>(input & 0xFF), m_file);
+    ++m_header.numticks;
+}
+
+bool InputRecorder::close()
+{
+    if (m_file == nullptr)
+        return true;
+
+    const bool success =
+        fseek(m_file, 0, SEEK_SET) == 0 &&
+        fwrite(&m_header, sizeof(m_header), 1, m_file) == 1;
+
+    const bool closed = fclose(m_file) == 0;
+    m_file = nullptr;
+
+    return success && closed;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+//
+// Recordings of the input of every simulation tick, to replay a session
+// exactly. A file is a header followed by one byte of InputBits per tick.
+// The simulation is deterministic given its tick rate and inputs, so a
+// replay follows the same player trajectory bit for bit.
+//
+
+struct InputRecordingHeader
+{
+    char magic[4];          // "WINP"
+    uint32_t version;
+    float tickrate;
+    uint32_t numticks;
+};
+
+const uint32_t InputRecordingVersion = 1;
+
+struct InputRecording
+{
+    float tickrate;
+    std::vector<uint8_t> inputs;
+};
+
+bool load_input_recording(const char* filepath, InputRecording* recording);
+
+class InputRecorder
+{
+  public:
+    InputRecorder();
+    ~InputRecorder();
+
+    bool open(const char* filepath, const float tickrate);
+
+    bool is_open() const;
+
+    void record(const uint32_t input);
+
+    // Write the number of ticks into the header and close the file.
+    bool close();
+
+  private:
+    FILE* m_file;
+    InputRecordingHeader m_header;
+};
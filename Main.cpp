@@ -1,659 +1,662 @@
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "Engine.h"
+#include "Golden.h"
+#include "InputRecording.h"
+#include "Overlay.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 
 #include <SDL.h>
 #include <SDL_main.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
-#define FLIP
 #define VSYNC
 #define MULTITHREAD
 
-const int ScreenWidth = 1280;
-const int ScreenHeight = 720;
+Engine engine;
+World world;
 
-#ifdef NDEBUG
-#define myassert(cond)
-#else
-#define myassert(cond) if (!(cond)) { __debugbreak(); }
-#endif
+ProfileHistory profilehistory;
 
-template <typename T>
-T min(const T x, const T y)
-{
-    return x < y ? x : y;
-}
+// Where the profile hotkey writes to when --profile-out is not given.
+const char* DefaultProfilePath = "profile.csv";
 
-template <typename T>
-T max(const T x, const T y)
-{
-    return x > y ? x : y;
-}
+const int MaxFramesInFlight = 3;
 
-const float Pi = 3.1415926535897932f;
-const float Infinity = 1.0e20f;
+//
+// Frames are rendered in order on a dedicated thread, which drives the thread
+// pool, while the main thread simulates the next frame and uploads and
+// presents the previous ones. With a depth of 1 the loop is serial.
+//
 
-float dtor(float d)
+class FramePipeline
 {
-    return d * Pi / 180.0f;
-}
+  public:
+    FramePipeline()
+      : m_depth(0)
+      , m_submitted(0)
+      , m_rendered(0)
+      , m_released(0)
+      , m_quit(false)
+    {
+    }
 
-struct ScreenPixel
-{
-    uint8_t b;
-    uint8_t g;
-    uint8_t r;
-    uint8_t a;
-};
+    void start(const int depth, const int numthreads, const int* cpus, const int numcpus)
+    {
+        m_depth = min(max(depth, 1), MaxFramesInFlight);
+        for (int i = 0; i < m_depth; ++i)
+            m_frames[i].pixels = new ScreenPixel[ScreenWidth * ScreenHeight];
 
-ScreenPixel rgb(uint8_t r, uint8_t g, uint8_t b)
-{
-    return { b, g, r, 255 };
-}
+        m_submitted = m_rendered = m_released = 0;
+        m_quit = false;
+        m_thread = thread(&FramePipeline::thread_main, this, numthreads, cpus, numcpus);
+    }
 
-void setpix(ScreenPixel* pixels, const int x, const int y, const ScreenPixel& color)
-{
-#ifdef FLIP
-    pixels[x * ScreenHeight + y] = color;
-#else
-    pixels[y * ScreenWidth + x] = color;
-#endif
-}
+    void stop()
+    {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_submitted_cv.notify_one();
+        m_thread.join();
 
-#if 0
+        for (int i = 0; i < m_depth; ++i)
+            delete[] m_frames[i].pixels;
+        m_depth = 0;
+    }
 
-const int MapW = 4;
-const int MapH = 4;
+    int depth() const
+    {
+        return m_depth;
+    }
 
-// (0,0) at bottom left.
-const uint8_t Map[MapW * MapH] =
-{
-    1, 1, 1, 1,
-    1, 0, 0, 1,
-    1, 0, 0, 1,
-    1, 1, 1, 1
-};
+    int in_flight() const
+    {
+        return static_cast<int>(m_submitted - m_released);
+    }
 
-#else
+    // State of the next frame to submit; its slot is never in use.
+    FrameState& next_state()
+    {
+        myassert(in_flight() < m_depth);
+        return m_frames[m_submitted % m_depth].state;
+    }
 
-const int MapW = 8;
-const int MapH = 8;
+    FrameProfile& next_profile()
+    {
+        myassert(in_flight() < m_depth);
+        return m_frames[m_submitted % m_depth].profile;
+    }
 
-// (0,0) at bottom left.
-const uint8_t Map[MapW * MapH] =
-{
-    1, 1, 1, 1, 1, 1, 1, 1,
-    1, 0, 0, 0, 0, 0, 0, 1,
-    1, 0, 0, 1, 1, 1, 0, 1,
-    1, 0, 0, 0, 0, 1, 0, 1,
-    1, 0, 0, 1, 0, 0, 0, 1,
-    1, 0, 0, 1, 0, 1, 1, 1,
-    1, 0, 0, 1, 0, 0, 0, 1,
-    1, 1, 1, 1, 1, 1, 1, 1
-};
+    void submit()
+    {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            ++m_submitted;
+        }
+        m_submitted_cv.notify_one();
+    }
 
-#endif
+    // Wait for the oldest frame in flight to be rendered.
+    ScreenPixel* wait_oldest()
+    {
+        myassert(in_flight() > 0);
+        unique_lock<mutex> lock(m_mutex);
+        m_rendered_cv.wait(lock, [this]() { return m_rendered > m_released; });
+        return m_frames[m_released % m_depth].pixels;
+    }
 
-uint8_t safemap(const int ix, const int iy)
-{
-    return
-        ix >= 0 &&
-        iy >= 0 &&
-        ix <= MapW - 1 &&
-        iy <= MapH - 1
-            ? Map[(MapH - 1 - iy) * MapW + ix]
-            : 1;
-}
+    FrameProfile& oldest_profile()
+    {
+        return m_frames[m_released % m_depth].profile;
+    }
 
-uint8_t map(const int ix, const int iy)
-{
-    myassert(
-        ix >= 0 &&
-        iy >= 0 &&
-        ix <= MapW - 1 &&
-        iy <= MapH - 1);
-    return safemap(ix, iy);
-}
+    void release_oldest()
+    {
+        ++m_released;
+    }
+
+  private:
+    struct Frame
+    {
+        FrameState state;
+        FrameProfile profile;
+        ScreenPixel* pixels;
+    };
+
+    Frame m_frames[MaxFramesInFlight];
+    int m_depth;
+
+    thread m_thread;
+    mutex m_mutex;
+    condition_variable m_submitted_cv;
+    condition_variable m_rendered_cv;
+    uint64_t m_submitted;
+    uint64_t m_rendered;
+    uint64_t m_released;
+    bool m_quit;
+
+    void thread_main(const int numthreads, const int* cpus, const int numcpus)
+    {
+        engine.pool.start(numthreads, cpus, numcpus);
 
-const float HFov = dtor(90.0f);
-const float VFov = HFov * ScreenHeight / ScreenWidth;
-const float FilmWidth = 0.01f;
-const float FilmHeight = FilmWidth * ScreenHeight / ScreenWidth;
-const float FocalLength = FilmWidth / 2.0f * tan(HFov / 2.0f);
-const float WallHeight = 1.0f;
-const float WallPadding = 0.1f;
+        trace_register_thread("render");
 
-const float PlayerWalkSpeed = 0.03f;
-const float PlayerRunSpeed = 0.06f;
-const float PlayerRotateSpeed = dtor(5.0f);
+        while (true)
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_submitted_cv.wait(lock, [this]() { return m_quit || m_submitted > m_rendered; });
+            if (m_quit)
+                break;
 
-struct Player
-{
-    float x, y, a;
+            Frame& frame = m_frames[m_rendered % m_depth];
+            lock.unlock();
 
-    void reset()
-    {
-        x = 2.0f;
-        y = 2.0f;
-        a = dtor(90.0f);
+            render(&engine, &world, frame.state, frame.pixels, &frame.profile);
+
+            lock.lock();
+            ++m_rendered;
+            lock.unlock();
+            m_rendered_cv.notify_one();
+        }
+
+        engine.pool.stop();
     }
 };
 
-struct Texture
+uint32_t read_input()
 {
-    int w, h, n;
-    uint8_t* data;
-};
+    const uint8_t* keys = SDL_GetKeyboardState(nullptr);
 
-void load_texture(Texture* tex, const char* filepath)
-{
-    tex->data = stbi_load(filepath, &tex->w, &tex->h, &tex->n, 4);
-}
+    uint32_t input = 0;
+    if (keys[SDL_SCANCODE_LEFT]) input |= InputLeft;
+    if (keys[SDL_SCANCODE_RIGHT]) input |= InputRight;
+    if (keys[SDL_SCANCODE_UP]) input |= InputForward;
+    if (keys[SDL_SCANCODE_DOWN]) input |= InputBackward;
+    if (keys[SDL_SCANCODE_LSHIFT] | keys[SDL_SCANCODE_RSHIFT]) input |= InputRun;
+    if (keys[SDL_SCANCODE_LALT]) input |= InputStrafe;
 
-const uint8_t* lookup_texture(const Texture* tex, int x, int y)
-{
-    if (x < 0) x += tex->w;
-    if (y < 0) y += tex->h;
-    if (x > tex->w - 1) x -= tex->w;
-    if (y > tex->h - 1) y -= tex->h;
-    return &tex->data[(y * tex->w + x) * 4];
+    return input;
 }
 
-const int NumTextures = 1;
-const char* TextureFilePaths[NumTextures] =
+void present(SDL_Renderer* renderer, SDL_Texture* screen_texture, const ScreenPixel* pixels, FrameProfile* profile)
 {
-    "textures/407.png"
-};
+    {
+        TraceScope scope("upload");
+        ScopedTimer timer(&profile->stages[StageUpload]);
+        ScopedCounters counters(profile->counters[StageUpload]);
+#ifdef FLIP
+        SDL_UpdateTexture(screen_texture, nullptr, pixels, ScreenHeight * sizeof(ScreenPixel));
+#else
+        SDL_UpdateTexture(screen_texture, nullptr, pixels, ScreenWidth * sizeof(ScreenPixel));
+#endif
+    }
 
-Texture textures[1];
+    TraceScope scope("present");
+    ScopedTimer timer(&profile->stages[StagePresent]);
+    ScopedCounters counters(profile->counters[StagePresent]);
 
-Player player;
-bool texture = true;
-bool bilinear = false;
-bool minimap = false;
+    SDL_RenderClear(renderer);
 
-void init()
-{
-    for (int i = 0; i < NumTextures; ++i)
-        load_texture(&textures[i], TextureFilePaths[i]);
+#ifdef FLIP
+    SDL_Rect dstrect;
+    dstrect.x = (ScreenWidth - ScreenHeight) / 2 - 1;
+    dstrect.y = (ScreenHeight - ScreenWidth) / 2;
+    dstrect.w = ScreenHeight;
+    dstrect.h = ScreenWidth;
+    SDL_RenderCopyEx(renderer, screen_texture, nullptr, &dstrect, 90, nullptr, SDL_FLIP_VERTICAL);
+#else
+    SDL_RenderCopy(renderer, screen_texture, nullptr, nullptr);
+#endif
 
-    player.reset();
+    SDL_RenderPresent(renderer);
 }
 
-void done()
+// Room for events of each thread when tracing, about 32 MB per thread.
+const int TraceEventsPerThread = 1 << 20;
+
+void write_trace(const char* tracepath)
 {
-    for (int i = 0; i < NumTextures; ++i)
-        stbi_image_free(textures[i].data);
+    if (tracepath == nullptr)
+        return;
+
+    if (trace_write(tracepath))
+        fprintf(stderr, "Wrote trace to %s\n", tracepath);
+    else fprintf(stderr, "Failed to write %s\n", tracepath);
+
+    trace_stop();
 }
 
-bool cast_ray(
-    const float x0, const float y0,
-    const float x1, const float y1,
-    float* hx, float* hy,
-    float* u)
+// Parse a comma-separated list of CPU indices such as "0,2,4,6".
+int parse_cpu_list(const char* s, int* cpus, const int maxcpus)
 {
-    myassert(x0 >= 0.0f && x0 < static_cast<float>(MapW));
-    myassert(y0 >= 0.0f && y0 < static_cast<float>(MapH));
+    int numcpus = 0;
 
-    float x = x0;
-    float y = y0;
+    while (*s != '\0' && numcpus < maxcpus)
+    {
+        char* end;
+        const long cpu = strtol(s, &end, 10);
+        if (end == s || cpu < 0 || cpu >= ThreadPool::cpu_limit())
+            return -1;
 
-    int ix = static_cast<int>(x);
-    int iy = static_cast<int>(y);
+        cpus[numcpus++] = static_cast<int>(cpu);
 
-    if (x == ix && x1 < x0)
-        ix -= 1;
+        s = end;
+        if (*s == ',')
+            ++s;
+    }
 
-    if (y == iy && y1 < y0)
-        iy -= 1;
+    return numcpus;
+}
 
-    myassert(map(ix, iy) == 0);
+// Number of frames rendered before timing starts.
+const int BenchmarkWarmupFrames = 10;
 
-    const int ix1 = static_cast<int>(x1);
-    const int iy1 = static_cast<int>(y1);
+// Speed of the generated camera path, in map cells per frame.
+const float BenchmarkCellsPerFrame = 0.05f;
 
-    while (true)
-    {
-        const float dx = x1 - x;
-        const float dy = y1 - y;
-
-        float wallx, tx;
-        if (dx > 0.0f)
-        {
-            wallx = ceil(x);
-            if (x == wallx)
-                wallx += 1.0f;
-            myassert(x < wallx);
+// Generate a camera path touring every free cell reachable from the player
+// start. Cells are visited depth first and revisited on the way back, so
+// consecutive waypoints are always neighbours and the camera never goes
+// through a wall.
+void generate_camera_path(const int numframes, vector<Player>* path)
+{
+    Player start;
+    start.reset();
 
-            tx = (wallx - x) / dx;
-            myassert(tx > 0.0f);
-        }
-        else if (dx < 0.0f)
-        {
-            wallx = floor(x);
-            if (x == wallx)
-                wallx -= 1.0f;
-            myassert(x > wallx);
+    vector<int> waypoints;
+    vector<bool> visited(world.map.w * world.map.h, false);
+    vector<pair<int, int>> stack;   // cell, next direction to try
 
-            tx = (wallx - x) / dx;
-            myassert(tx > 0.0f);
-        }
-        else tx = Infinity;
+    const int startcell = static_cast<int>(start.y) * world.map.w + static_cast<int>(start.x);
+    visited[startcell] = true;
+    waypoints.push_back(startcell);
+    stack.push_back(make_pair(startcell, 0));
 
-        float wally, ty;
-        if (dy > 0.0f)
-        {
-            wally = ceil(y);
-            if (y == wally)
-                wally += 1.0f;
-            myassert(y < wally);
+    while (!stack.empty())
+    {
+        const int cell = stack.back().first;
+        const int dir = stack.back().second++;
 
-            ty = (wally - y) / dy;
-            myassert(ty > 0.0f);
-        }
-        else if (dy < 0.0f)
+        if (dir == 4)
         {
-            wally = floor(y);
-            if (y == wally)
-                wally -= 1.0f;
-            myassert(y > wally);
-
-            ty = (wally - y) / dy;
-            myassert(ty > 0.0f);
+            stack.pop_back();
+            if (!stack.empty())
+                waypoints.push_back(stack.back().first);
+            continue;
         }
-        else ty = Infinity;
 
-        myassert(tx < Infinity || ty < Infinity);
+        const int DirX[4] = { 1, 0, -1, 0 };
+        const int DirY[4] = { 0, 1, 0, -1 };
+        const int ix = cell % world.map.w + DirX[dir];
+        const int iy = cell / world.map.w + DirY[dir];
 
-        if (tx < ty)
+        if (safemap(world.map, ix, iy) == 0 && !visited[iy * world.map.w + ix])
         {
-            x = wallx;
-            y += tx * dy;
+            visited[iy * world.map.w + ix] = true;
+            waypoints.push_back(iy * world.map.w + ix);
+            stack.push_back(make_pair(iy * world.map.w + ix, 0));
+        }
+    }
 
-            myassert(dx != 0.0f);
-            if (dx > 0.0f)
-            {
-                ix += 1;
-                myassert(ix == static_cast<int>(x));
-                myassert(ix <= MapW - 1);
-                iy = static_cast<int>(y);
-            }
-            else
-            {
-                ix -= 1;
-                //myassert(ix == static_cast<int>(x));
-                myassert(ix >= 0);
-                iy = static_cast<int>(y);
-            }
+    const int numsegments = static_cast<int>(waypoints.size()) - 1;
 
-            if (map(ix, iy) != 0)
-            {
-                *hx = x;
-                *hy = y;
-                *u = y - iy;
-                return true;
-            }
-        }
-        else
-        {
-            x += ty * dx;
-            y = wally;
+    for (int i = 0; i < numframes; ++i)
+    {
+        // Sway the view around the direction of travel to vary wall distances.
+        const float sway = dtor(45.0f) * sin(i * 0.02f);
 
-            myassert(dy != 0.0f);
-            if (dy > 0.0f)
-            {
-                iy += 1;
-                myassert(iy == static_cast<int>(y));
-                myassert(iy <= MapH - 1);
-                ix = static_cast<int>(x);
-            }
-            else
-            {
-                iy -= 1;
-                //myassert(iy == static_cast<int>(y));
-                myassert(iy >= 0);
-                ix = static_cast<int>(x);
-            }
+        Player pose = start;
+        pose.a = start.a + sway;
 
-            if (map(ix, iy) != 0)
-            {
-                *hx = x;
-                *hy = y;
-                *u = x - ix;
-                return true;
-            }
+        if (numsegments > 0)
+        {
+            const float s = i * BenchmarkCellsPerFrame;
+            const int segment = static_cast<int>(s) % numsegments;
+            const float t = s - floor(s);
+
+            const int from = waypoints[segment];
+            const int to = waypoints[segment + 1];
+            const float x0 = from % world.map.w + 0.5f;
+            const float y0 = from / world.map.w + 0.5f;
+            const float x1 = to % world.map.w + 0.5f;
+            const float y1 = to / world.map.w + 0.5f;
+
+            pose.x = x0 + (x1 - x0) * t;
+            pose.y = y0 + (y1 - y0) * t;
+            pose.a = atan2(y1 - y0, x1 - x0) + sway;
         }
 
-        if (ix == ix1 && iy == iy1)
-            return false;
+        path->push_back(pose);
     }
 }
 
-void update()
+// Read a camera path made of one "x y a" line per frame.
+bool load_camera_path(const char* filepath, vector<Player>* path)
 {
-    const uint8_t* keys = SDL_GetKeyboardState(nullptr);
+    FILE* file = fopen(filepath, "rt");
+    if (file == nullptr)
+        return false;
 
-    float dx = 0.0f, dy = 0.0f;
+    Player pose;
+    while (fscanf(file, "%f %f %f", &pose.x, &pose.y, &pose.a) == 3)
+        path->push_back(pose);
 
-    const float movespeed =
-        (keys[SDL_SCANCODE_LSHIFT] | keys[SDL_SCANCODE_RSHIFT]) ? PlayerRunSpeed : PlayerWalkSpeed;
+    fclose(file);
 
-    if (keys[SDL_SCANCODE_LEFT])
+    return !path->empty();
+}
+
+// Simulate a recording from the player start, with one camera pose per tick.
+void replay_camera_path(const InputRecording& recording, vector<Player>* path)
+{
+    world.tickrate = recording.tickrate;
+    reset_player(&world);
+
+    for (size_t i = 0; i < recording.inputs.size(); ++i)
     {
-        if (keys[SDL_SCANCODE_LALT])
-        {
-            dx += movespeed * cos(player.a + Pi / 2.0f);
-            dy += movespeed * sin(player.a + Pi / 2.0f);
-        }
-        else player.a += PlayerRotateSpeed;
+        step(&world, recording.inputs[i], 1);
+        path->push_back(world.player);
     }
+}
+
+double percentile(const vector<double>& sorted, const double p)
+{
+    const size_t rank = static_cast<size_t>(ceil(p * static_cast<double>(sorted.size())));
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
 
-    if (keys[SDL_SCANCODE_RIGHT])
+// Load the default textures, from an asset pack if one is given, in which
+// case the level packed with them replaces the built-in one when present.
+// With a texture budget of 0 MB or more, textures are streamed instead.
+bool init_engine(const char* packpath, const int texturebudget)
+{
+    if (packpath == nullptr)
+        init(&engine);
+    else
     {
-        if (keys[SDL_SCANCODE_LALT])
+        init(&engine, packpath);
+
+        if (!engine.pack.is_open())
         {
-            dx += movespeed * cos(player.a - Pi / 2.0f);
-            dy += movespeed * sin(player.a - Pi / 2.0f);
+            fprintf(stderr, "Failed to open asset pack %s\n", packpath);
+            return false;
         }
-        else player.a -= PlayerRotateSpeed;
-    }
 
-    if (keys[SDL_SCANCODE_UP])
-    {
-        dx += movespeed * cos(player.a);
-        dy += movespeed * sin(player.a);
+        load_map(&world, engine.pack, DefaultMapAsset);
     }
 
-    if (keys[SDL_SCANCODE_DOWN])
-    {
-        dx -= movespeed * cos(player.a);
-        dy -= movespeed * sin(player.a);
-    }
+    if (texturebudget >= 0)
+        stream_textures(&engine, static_cast<size_t>(texturebudget) << 20);
 
-    const int ix = static_cast<int>(player.x);
-    const int iy = static_cast<int>(player.y);
+    return true;
+}
 
-    myassert(map(ix, iy) == 0);
+// Render a camera path offscreen, without SDL, and report frame time statistics.
+int run_benchmark(
+    const int numframes,
+    const char* camerapath,
+    const InputRecording* replay,
+    const char* profilepath,
+    const char* packpath,
+    const int texturebudget,
+    const int numthreads,
+    const int* cpus,
+    const int numcpus)
+{
+    if (!init_engine(packpath, texturebudget))
+        return 1;
 
-    for (int y = iy - 1; y <= iy + 1; ++y)
+    vector<Player> path;
+    if (camerapath != nullptr)
     {
-        for (int x = ix - 1; x <= ix + 1; ++x)
+        if (!load_camera_path(camerapath, &path))
         {
-            if (x == ix && y == iy)
-                continue;
+            fprintf(stderr, "Failed to load camera path %s\n", camerapath);
+            done(&engine);
+            return 1;
+        }
+    }
+    else if (replay != nullptr)
+        replay_camera_path(*replay, &path);
+    else generate_camera_path(BenchmarkWarmupFrames + numframes, &path);
 
-            if (safemap(x, y) != 0)
-            {
-                const float blockx0 = x - WallPadding;
-                const float blocky0 = y - WallPadding;
-                const float blockx1 = x + 1 + WallPadding;
-                const float blocky1 = y + 1 + WallPadding;
+    engine.pool.start(numthreads, cpus, numcpus);
 
-                if (dx > 0.0f && safemap(x - 1, y) == 0)
-                {
-                    const float t = (blockx0 - player.x) / dx;
-                    if (t >= 0.0f && t < 1.0f)
-                    {
-                        const float ay = player.y + t * dy;
-                        if (ay >= blocky0 && ay <= blocky1)
-                        {
-                            dx = blockx0 - player.x;
-                        }
-                    }
-                }
+    ScreenPixel* pixels = new ScreenPixel[ScreenWidth * ScreenHeight];
+    FrameProfile* profile = new FrameProfile();
+    FrameState state = capture_frame_state(&world, 1.0f);
 
-                if (dx < 0.0f && safemap(x + 1, y) == 0)
-                {
-                    const float t = (blockx1 - player.x) / dx;
-                    if (t >= 0.0f && t < 1.0f)
-                    {
-                        const float ay = player.y + t * dy;
-                        if (ay >= blocky0 && ay <= blocky1)
-                        {
-                            dx = blockx1 - player.x;
-                        }
-                    }
-                }
+    vector<double> times;
+    times.reserve(numframes);
 
-                if (dy > 0.0f && safemap(x, y - 1) == 0)
-                {
-                    const float t = (blocky0 - player.y) / dy;
-                    if (t >= 0.0f && t < 1.0f)
-                    {
-                        const float ax = player.x + t * dx;
-                        if (ax >= blockx0 && ax <= blockx1)
-                        {
-                            dy = blocky0 - player.y;
-                        }
-                    }
-                }
+    for (int i = 0; i < BenchmarkWarmupFrames + numframes; ++i)
+    {
+        state.player = path[i % path.size()];
 
-                if (dy < 0.0f && safemap(x, y + 1) == 0)
-                {
-                    const float t = (blocky1 - player.y) / dy;
-                    if (t >= 0.0f && t < 1.0f)
-                    {
-                        const float ax = player.x + t * dx;
-                        if (ax >= blockx0 && ax <= blockx1)
-                        {
-                            dy = blocky1 - player.y;
-                        }
-                    }
-                }
-            }
-        }
-    }
+        profile->clear();
+        profile->frame = i;
 
-    player.x += dx;
-    player.y += dy;
-}
+        const uint64_t startticks = profile_now();
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        render(&engine, &world, state, pixels, profile);
+        const chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        profile->stages[StageFrame] = profile_now() - startticks;
 
-void renderview(ScreenPixel* pixels)
-{
-#ifdef MULTITHREAD
-#pragma omp parallel for
-#endif
-    for (int x = 0; x < ScreenWidth; ++x)
-    {
-        const float sx = (FilmWidth * 0.5f) - (x + 0.5f) * (FilmWidth / ScreenWidth);
-        const float a = player.a + atan2(sx, FocalLength);
-
-        const float MaxDist = 1000.0f;
-        float hx, hy;
-        float u;
-        if (cast_ray(
-                player.x, player.y,
-                player.x + MaxDist * cos(a),
-                player.y + MaxDist * sin(a),
-                &hx, &hy,
-                &u))
+        if (i >= BenchmarkWarmupFrames)
         {
-            const float dx = hx - player.x;
-            const float dy = hy - player.y;
-            const float d = sqrt(dx * dx + dy * dy) * cos(a - player.a);
-            const float h = FocalLength * WallHeight / d;
-
-            const int wallheight = static_cast<int>(h / FilmHeight * ScreenHeight);
-            const float rcpwallheight = 1.0f / wallheight;
-            const int wallstarty = ScreenHeight / 2 - wallheight / 2;
-            const int wallendy = ScreenHeight / 2 + wallheight / 2;
-            const int starty = max(wallstarty, 0);
-            const int endy = min(wallendy, ScreenHeight);
-
-            // Sky.
-            for (int y = 0; y < starty; ++y)
-            {
-#ifdef FLIP
-                pixels[x * ScreenHeight + y] = rgb(155, 226, 255);
-#else
-                pixels[y * ScreenWidth + x] = rgb(155, 226, 255);
-#endif
-            }
-
-            // Floor.
-            for (int y = endy; y < ScreenHeight; ++y)
-            {
-#ifdef FLIP
-                pixels[x * ScreenHeight + y] = rgb(53, 37, 26);
-#else
-                pixels[y * ScreenWidth + x] = rgb(53, 37, 26);
-#endif
-            }
+            times.push_back(chrono::duration<double, milli>(end - start).count());
+            profilehistory.push(*profile);
+        }
+    }
 
-            // Walls.
-            if (texture)
-            {
-                const float shade = 1.0f - min(d / 8.0f, 1.0f);
+    engine.pool.stop();
+    delete profile;
+    delete[] pixels;
+    done(&engine);
 
-                if (bilinear)
-                {
-                    const float su = u * textures[0].w - 0.5f;
-                    const int iu = static_cast<int>(floor(su));
-                    const float fu0 = su - iu;
-                    const float fu1 = 1.0f - fu0;
-                    myassert(fu0 >= 0.0f && fu0 < 1.0f);
+    if (profilepath != nullptr && !profilehistory.write(profilepath))
+        fprintf(stderr, "Failed to write %s\n", profilepath);
 
-                    for (int y = starty; y < endy; ++y)
-                    {
-                        const float v = (y - wallstarty + 0.5f) * rcpwallheight;
-                        const float sv = v * textures[0].h - 0.5f;
-                        const int iv = static_cast<int>(floor(sv));
-                        const float fv0 = sv - iv;
-                        const float fv1 = 1.0f - fv0;
-                        myassert(fv0 >= 0.0f && fv0 < 1.0f);
-
-                        const Texture* tex = &textures[0];
-                        const uint8_t* data00 = lookup_texture(tex, iu + 0, iv + 0);
-                        const uint8_t* data10 = lookup_texture(tex, iu + 1, iv + 0);
-                        const uint8_t* data01 = lookup_texture(tex, iu + 0, iv + 1);
-                        const uint8_t* data11 = lookup_texture(tex, iu + 1, iv + 1);
-
-                        float r = (data00[0] * fu1 + data10[0] * fu0) * fv1 + (data01[0] * fu1 + data11[0] * fu0) * fv0;
-                        float g = (data00[1] * fu1 + data10[1] * fu0) * fv1 + (data01[1] * fu1 + data11[1] * fu0) * fv0;
-                        float b = (data00[2] * fu1 + data10[2] * fu0) * fv1 + (data01[2] * fu1 + data11[2] * fu0) * fv0;
-
-                        r *= shade;
-                        g *= shade;
-                        b *= shade;
+    double total = 0.0;
+    for (size_t i = 0; i < times.size(); ++i)
+        total += times[i];
+    const double mean = total / static_cast<double>(times.size());
 
-#ifdef FLIP
-                        pixels[x * ScreenHeight + y] =
-#else
-                        pixels[y * ScreenWidth + x] =
-#endif
-                            rgb(
-                                static_cast<uint8_t>(r),
-                                static_cast<uint8_t>(g),
-                                static_cast<uint8_t>(b));
-                    }
-                }
-                else
-                {
-                    const float su = u * textures[0].w;
-                    const int iu = static_cast<int>(su);
-                    myassert(iu >= 0 && iu < textures[0].w);
-                    const float fu = su - iu;
-                    myassert(fu >= 0.0f && fu < 1.0f);
+    sort(times.begin(), times.end());
 
-                    for (int y = starty; y < endy; ++y)
-                    {
-                        const float v = (y - wallstarty + 0.5f) * rcpwallheight;
-                        const float sv = v * textures[0].h;
-                        const int iv = static_cast<int>(sv);
-                        myassert(iv >= 0 && iv < textures[0].h);
-                        const float fv = sv - iv;
-                        myassert(fv >= 0.0f && fv < 1.0f);
+    printf("Resolution : %dx%d\n", ScreenWidth, ScreenHeight);
+    printf("Threads    : %d\n", numthreads);
+    printf("Frames     : %d\n", numframes);
+    printf("Mean       : %.3f ms (%.1f fps)\n", mean, 1000.0 / mean);
+    printf("p50        : %.3f ms\n", percentile(times, 0.50));
+    printf("p95        : %.3f ms\n", percentile(times, 0.95));
+    printf("p99        : %.3f ms\n", percentile(times, 0.99));
+    printf("Max        : %.3f ms\n", times.back());
+    printf("\n");
+    profilehistory.write_summary(stdout);
 
-                        const Texture* tex = &textures[0];
-                        const uint8_t* data = &tex->data[(iv * tex->w + iu) * 4];
+    return 0;
+}
 
-#ifdef FLIP
-                        pixels[x * ScreenHeight + y] =
+extern "C" int main(int argc, char* argv[])
+{
+#ifdef MULTITHREAD
+    int numthreads = static_cast<int>(thread::hardware_concurrency());
 #else
-                        pixels[y * ScreenWidth + x] =
+    int numthreads = 1;
 #endif
-                            rgb(
-                                static_cast<uint8_t>(data[0] * shade),
-                                static_cast<uint8_t>(data[1] * shade),
-                                static_cast<uint8_t>(data[2] * shade));
-                    }
-                }
-            }
-            else
+
+    const int MaxCpus = 256;
+    int cpus[MaxCpus];
+    int numcpus = 0;
+
+    int framesinflight = 2;
+
+    int benchmarkframes = 0;
+    const char* camerapath = nullptr;
+    const char* recordcamerapath = nullptr;
+    const char* recordinputpath = nullptr;
+    const char* replaypath = nullptr;
+    const char* profilepath = nullptr;
+    const char* tracepath = nullptr;
+    const char* packpath = nullptr;
+    int texturebudget = -1;
+    bool perfcounters = false;
+    bool overlay = false;
+
+    const char* goldendir = nullptr;
+    bool goldenupdate = false;
+    int goldentolerance = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            numthreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc)
+            world.tickrate = static_cast<float>(atof(argv[++i]));
+        else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+            framesinflight = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+            benchmarkframes = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--camera-path") == 0 && i + 1 < argc)
+            camerapath = argv[++i];
+        else if (strcmp(argv[i], "--record-camera-path") == 0 && i + 1 < argc)
+            recordcamerapath = argv[++i];
+        else if (strcmp(argv[i], "--record-input") == 0 && i + 1 < argc)
+            recordinputpath = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replaypath = argv[++i];
+        else if (strcmp(argv[i], "--profile-out") == 0 && i + 1 < argc)
+            profilepath = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            tracepath = argv[++i];
+        else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+            packpath = argv[++i];
+        else if (strcmp(argv[i], "--stream-textures") == 0 && i + 1 < argc)
+            texturebudget = max(atoi(argv[++i]), 0);
+        else if (strcmp(argv[i], "--perf-counters") == 0)
+            perfcounters = true;
+        else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+            goldendir = argv[++i];
+        else if (strcmp(argv[i], "--golden-update") == 0 && i + 1 < argc)
+        {
+            goldendir = argv[++i];
+            goldenupdate = true;
+        }
+        else if (strcmp(argv[i], "--golden-tolerance") == 0 && i + 1 < argc)
+            goldentolerance = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--no-texture") == 0)
+            world.texture = false;
+        else if (strcmp(argv[i], "--bilinear") == 0)
+            world.bilinear = true;
+        else if (strcmp(argv[i], "--minimap") == 0)
+            world.minimap = true;
+        else if (strcmp(argv[i], "--overlay") == 0)
+            overlay = true;
+        else if (strcmp(argv[i], "--affinity") == 0 && i + 1 < argc)
+        {
+            numcpus = parse_cpu_list(argv[++i], cpus, MaxCpus);
+            if (numcpus < 0)
             {
-                for (int y = starty; y < endy; ++y)
-                {
-#ifdef FLIP
-                    pixels[x * ScreenHeight + y] = rgb(80, 80, 80);
-#else
-                    pixels[y * ScreenWidth + x] = rgb(80, 80, 80);
-#endif
-                }
+                fprintf(stderr, "Invalid CPU list: %s\n", argv[i]);
+                return 1;
             }
         }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
     }
-}
 
-void rendermap(ScreenPixel* pixels)
-{
-    const int CellSize = 40;
+    if (numthreads < 1)
+        numthreads = 1;
 
-    for (int y = 0; y < MapH * CellSize; ++y)
+    // The tick rate is part of the recording.
+    InputRecording replay;
+    if (replaypath != nullptr)
     {
-        for (int x = 0; x < MapW * CellSize; ++x)
+        if (!load_input_recording(replaypath, &replay) || replay.inputs.empty())
         {
-            ScreenPixel color;
+            fprintf(stderr, "Failed to load input recording %s\n", replaypath);
+            return 1;
+        }
 
-            const float wx = static_cast<float>(x) / CellSize;
-            const float wy = static_cast<float>(y) / CellSize;
+        world.tickrate = replay.tickrate;
+    }
 
-            const int ix = static_cast<int>(wx);
-            const int iy = static_cast<int>(wy);
+    // A tick must last at least one period of the performance counter, which
+    // the fixed timestep counts in.
+    if (!(world.tickrate > 0.0f) || world.tickrate > static_cast<float>(SDL_GetPerformanceFrequency()))
+    {
+        fprintf(stderr, "Invalid tick rate\n");
+        return 1;
+    }
 
-            const uint8_t cell = map(ix, iy);
-            color = cell == 0 ? rgb(150, 150, 150) : rgb(220, 220, 220);
+    profile_calibrate();
 
-            const float fx = wx - ix;
-            const float fy = wy - iy;
+    if (perfcounters && !perf_counters_start())
+        fprintf(stderr, "Hardware performance counters are not available\n");
 
-            if (cell == 0)
-            {
-                if ((fx <= WallPadding && safemap(ix - 1, iy) != 0) ||
-                    (fx >= 1.0f - WallPadding && safemap(ix + 1, iy) != 0) ||
-                    (fy <= WallPadding && safemap(ix, iy - 1) != 0) ||
-                    (fy >= 1.0f - WallPadding && safemap(ix, iy + 1) != 0) ||
-                    (fx <= WallPadding && fy <= WallPadding && safemap(ix - 1, iy - 1) != 0) ||
-                    (fx >= 1.0f - WallPadding && fy <= WallPadding && safemap(ix + 1, iy - 1) != 0) ||
-                    (fx <= WallPadding && fy >= 1.0f - WallPadding && safemap(ix - 1, iy + 1)) ||
-                    (fx >= 1.0f - WallPadding && fy >= 1.0f - WallPadding && safemap(ix + 1, iy + 1) != 0))
-                    color = rgb(150, 180, 150);
-            }
+    if (tracepath != nullptr)
+    {
+        trace_start(TraceEventsPerThread);
+        trace_register_thread("main");
+    }
 
-            const float dpx = wx - player.x;
-            const float dpy = wy - player.y;
-            if (sqrt(dpx * dpx + dpy * dpy) <= 0.05f)
-                color = rgb(255, 0, 0);
+    if (goldendir != nullptr)
+    {
+        const int numfailures =
+            goldenupdate
+                ? update_golden_images(goldendir, numthreads)
+                : check_golden_images(goldendir, goldentolerance, numthreads);
+        return numfailures > 0 ? 1 : 0;
+    }
 
-            setpix(pixels, x, MapH * CellSize - 1 - y, color);
-        }
+    if (benchmarkframes > 0)
+    {
+        const int result = run_benchmark(benchmarkframes, camerapath, replaypath != nullptr ? &replay : nullptr, profilepath, packpath, texturebudget, numthreads, cpus, numcpus);
+        write_trace(tracepath);
+        return result;
     }
-}
 
-void render(ScreenPixel* pixels)
-{
-    renderview(pixels);
+    if (!init_engine(packpath, texturebudget))
+        return 1;
 
-    if (minimap)
-        rendermap(pixels);
-}
+    InputRecorder recorder;
+    if (recordinputpath != nullptr && !recorder.open(recordinputpath, world.tickrate))
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", recordinputpath);
+        return 1;
+    }
+
+    FILE* recordcamerafile = nullptr;
+    if (recordcamerapath != nullptr)
+    {
+        recordcamerafile = fopen(recordcamerapath, "wt");
+        if (recordcamerafile == nullptr)
+        {
+            fprintf(stderr, "Failed to open %s for writing\n", recordcamerapath);
+            return 1;
+        }
+    }
 
-extern "C" int main(int argc, char* argv[])
-{
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
     {
         fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
@@ -720,14 +723,23 @@ extern "C" int main(int argc, char* argv[])
 #endif
         );
 
-    ScreenPixel* pixels = new ScreenPixel[ScreenWidth * ScreenHeight];
-    
-    init();
+    FramePipeline pipeline;
+    pipeline.start(framesinflight, numthreads, cpus, numcpus);
+
+    const uint64_t tickperiod = static_cast<uint64_t>(SDL_GetPerformanceFrequency() / world.tickrate);
+    uint64_t lasttime = SDL_GetPerformanceCounter();
+    uint64_t accumulator = 0;
+
+    uint64_t framecount = 0;
+    uint64_t lastpresent = profile_now();
+
+    bool resetpending = false;
+    size_t replaytick = 0;
 
     bool quit = false;
     while (!quit)
     {
-        const uint32_t starttime = SDL_GetTicks();
+        TraceScope framescope("frame");
 
         SDL_Event e;
         while (SDL_PollEvent(&e))
@@ -746,20 +758,43 @@ extern "C" int main(int argc, char* argv[])
                     break;
 
                   case SDLK_b:
-                    bilinear = !bilinear;
+                    world.bilinear = !world.bilinear;
                     break;
 
                   case SDLK_r:
-                    player.reset();
+                    resetpending = true;
                     break;
 
                   case SDLK_t:
-                    texture = !texture;
+                    world.texture = !world.texture;
                     break;
 
                   case SDLK_TAB:
-                    minimap = !minimap;
+                    world.minimap = !world.minimap;
                     break;
+
+                  case SDLK_o:
+                    overlay = !overlay;
+                    break;
+
+                  case SDLK_EQUALS:
+                  case SDLK_KP_PLUS:
+                    world.minimapcellsize = min(world.minimapcellsize * 2, MaxMinimapCellSize);
+                    break;
+
+                  case SDLK_MINUS:
+                  case SDLK_KP_MINUS:
+                    world.minimapcellsize = max(world.minimapcellsize / 2, MinMinimapCellSize);
+                    break;
+
+                  case SDLK_p:
+                  {
+                    const char* filepath = profilepath != nullptr ? profilepath : DefaultProfilePath;
+                    if (profilehistory.write(filepath))
+                        fprintf(stderr, "Wrote profile to %s\n", filepath);
+                    else fprintf(stderr, "Failed to write %s\n", filepath);
+                    break;
+                  }
                 }
 
               default:
@@ -767,36 +802,95 @@ extern "C" int main(int argc, char* argv[])
             }
         }
 
-        update();
-        render(pixels);
+        const uint64_t now = SDL_GetPerformanceCounter();
+        accumulator = min(accumulator + (now - lasttime), MaxTicksPerFrame * tickperiod);
+        lasttime = now;
 
-#ifdef FLIP
-        SDL_UpdateTexture(screen_texture, nullptr, pixels, ScreenHeight * sizeof(ScreenPixel));
-#else
-        SDL_UpdateTexture(screen_texture, nullptr, pixels, ScreenWidth * sizeof(ScreenPixel));
-#endif
+        FrameProfile& profile = pipeline.next_profile();
+        profile.clear();
+        profile.frame = framecount++;
 
-        SDL_RenderClear(renderer);
+        {
+            TraceScope scope("update");
+            ScopedTimer timer(&profile.stages[StageUpdate]);
+            ScopedCounters counters(profile.counters[StageUpdate]);
 
-#ifdef FLIP
-        SDL_Rect dstrect;
-        dstrect.x = (ScreenWidth - ScreenHeight) / 2 - 1;
-        dstrect.y = (ScreenHeight - ScreenWidth) / 2;
-        dstrect.w = ScreenHeight;
-        dstrect.h = ScreenWidth;
-        SDL_RenderCopyEx(renderer, screen_texture, nullptr, &dstrect, 90, nullptr, SDL_FLIP_VERTICAL);
-#else
-        SDL_RenderCopy(renderer, screen_texture, nullptr, nullptr);
-#endif
+            uint32_t input = read_input() | (resetpending ? InputReset : 0);
+            while (accumulator >= tickperiod)
+            {
+                if (replaypath != nullptr)
+                {
+                    if (replaytick == replay.inputs.size())
+                    {
+                        quit = true;
+                        break;
+                    }
+                    input = replay.inputs[replaytick++];
+                }
+
+                step(&world, input, 1);
+                recorder.record(input);
+
+                // Resets only apply to the first tick.
+                input &= ~InputReset;
+                resetpending = false;
+
+                accumulator -= tickperiod;
+            }
+        }
 
-        SDL_RenderPresent(renderer);
+        const float alpha = static_cast<float>(accumulator) / static_cast<float>(tickperiod);
+        pipeline.next_state() = capture_frame_state(&world, alpha);
 
-        const uint32_t elapsed = SDL_GetTicks() - starttime;
-        const uint32_t fps = 1000 / elapsed;
-        fprintf(stderr, "fps: %u\n", fps);
+        if (recordcamerafile != nullptr)
+        {
+            const Player& pose = pipeline.next_state().player;
+            fprintf(recordcamerafile, "%.9g %.9g %.9g\n", pose.x, pose.y, pose.a);
+        }
+
+        pipeline.submit();
+
+        // Present frame N - depth + 1 while frame N renders.
+        if (pipeline.in_flight() == pipeline.depth())
+        {
+            ScreenPixel* pixels = pipeline.wait_oldest();
+            FrameProfile& oldest = pipeline.oldest_profile();
+
+            if (overlay)
+            {
+                TraceScope scope("overlay");
+                ScopedTimer timer(&oldest.stages[StageOverlay]);
+                ScopedCounters counters(oldest.counters[StageOverlay]);
+                draw_overlay(profilehistory, pixels);
+            }
+
+            present(renderer, screen_texture, pixels, &oldest);
+
+            const uint64_t now = profile_now();
+            oldest.stages[StageFrame] = now - lastpresent;
+            lastpresent = now;
+
+            profilehistory.push(oldest);
+            pipeline.release_oldest();
+        }
     }
 
-    done();
+    pipeline.stop();
+
+    if (profilepath != nullptr && !profilehistory.write(profilepath))
+        fprintf(stderr, "Failed to write %s\n", profilepath);
+
+    profilehistory.write_summary(stderr);
+
+    write_trace(tracepath);
+
+    if (recordcamerafile != nullptr)
+        fclose(recordcamerafile);
+
+    if (!recorder.close())
+        fprintf(stderr, "Failed to write %s\n", recordinputpath);
+
+    done(&engine);
     SDL_Quit();
 
     return 0;
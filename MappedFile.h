@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//
+// Read-only mapping of a whole file into memory. Processes mapping the same
+// file share its pages through the page cache.
+//
+
+class MappedFile
+{
+  public:
+    MappedFile();
+    ~MappedFile();
+
+    // Map a file, replacing any previous mapping. Fails on empty files.
+    bool open(const char* filepath);
+
+    void close();
+
+    bool is_open() const;
+
+    const uint8_t* data() const;
+    size_t size() const;
+
+  private:
+    const uint8_t* m_data;
+    size_t m_size;
+#if defined(_WIN32)
+    void* m_file;
+    void* m_mapping;
+#endif
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
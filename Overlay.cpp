@@ -0,0 +1,247 @@
+#include "Overlay.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+    const int GraphWidth = 256;             // one column per frame
+    const int FrameGraphHeight = 100;
+    const int StageGraphHeight = 60;
+    const float PixelsPerMs = 2.0f;
+    const int ThreadBarHeight = 3;
+    const int Padding = 4;
+    const int Margin = 8;
+
+    // Number of frames over which thread utilization is averaged.
+    const int UtilizationFrames = 16;
+
+    const double TargetMs = 1000.0 / 60.0;
+    const double SlowMs = 1000.0 / 30.0;
+
+    const int GlyphWidth = 3;
+    const int GlyphHeight = 5;
+    const int GlyphScale = 2;
+    const int TextHeight = GlyphHeight * GlyphScale;
+
+    // Digits 0 to 9 and the decimal point, one row of 3 bits per line.
+    const uint8_t Glyphs[11][GlyphHeight] =
+    {
+        { 7, 5, 5, 5, 7 },
+        { 2, 6, 2, 2, 7 },
+        { 7, 1, 7, 4, 7 },
+        { 7, 1, 7, 1, 7 },
+        { 5, 5, 7, 1, 1 },
+        { 7, 4, 7, 1, 7 },
+        { 7, 4, 7, 5, 7 },
+        { 7, 1, 1, 1, 1 },
+        { 7, 5, 7, 5, 7 },
+        { 7, 5, 7, 1, 7 },
+        { 0, 0, 0, 0, 2 }
+    };
+
+    // Stages that run one after the other, stacked from the bottom.
+    const int SerialStages[] = { StageUpdate, StageView, StageMinimap, StageOverlay, StageUpload, StagePresent };
+    const int NumSerialStages = sizeof(SerialStages) / sizeof(SerialStages[0]);
+
+    const ScreenPixel StageColors[NumSerialStages] =
+    {
+        rgb(80, 140, 255),
+        rgb(80, 220, 80),
+        rgb(80, 220, 220),
+        rgb(200, 200, 200),
+        rgb(255, 160, 40),
+        rgb(220, 80, 220)
+    };
+
+    const ScreenPixel White = rgb(255, 255, 255);
+    const ScreenPixel Gray = rgb(128, 128, 128);
+    const ScreenPixel Green = rgb(80, 220, 80);
+    const ScreenPixel Yellow = rgb(240, 220, 60);
+    const ScreenPixel Red = rgb(255, 60, 60);
+
+    // Same as getpix() and setpix(), inlined since the panel covers tens of
+    // thousands of pixels.
+    ScreenPixel& pixel(ScreenPixel* pixels, const int x, const int y)
+    {
+#ifdef FLIP
+        return pixels[x * ScreenHeight + y];
+#else
+        return pixels[y * ScreenWidth + x];
+#endif
+    }
+
+    // Columns in the outer loop since frames are usually stored column by column.
+    void darken(ScreenPixel* pixels, const int x0, const int y0, const int w, const int h)
+    {
+        for (int x = x0; x < x0 + w; ++x)
+        {
+            for (int y = y0; y < y0 + h; ++y)
+            {
+                ScreenPixel& p = pixel(pixels, x, y);
+                p.r /= 4;
+                p.g /= 4;
+                p.b /= 4;
+            }
+        }
+    }
+
+    void fill(ScreenPixel* pixels, const int x0, const int y0, const int w, const int h, const ScreenPixel& color)
+    {
+        for (int x = x0; x < x0 + w; ++x)
+        {
+            for (int y = y0; y < y0 + h; ++y)
+                pixel(pixels, x, y) = color;
+        }
+    }
+
+    int text_width(const char* text)
+    {
+        return static_cast<int>(strlen(text)) * (GlyphWidth + 1) * GlyphScale;
+    }
+
+    // Draw a string of digits and decimal points.
+    void draw_text(ScreenPixel* pixels, int x, const int y, const char* text, const ScreenPixel& color)
+    {
+        for (const char* c = text; *c != '\0'; ++c)
+        {
+            const int glyph = *c == '.' ? 10 : *c - '0';
+            if (glyph < 0 || glyph > 10)
+                continue;
+
+            for (int row = 0; row < GlyphHeight; ++row)
+            {
+                for (int col = 0; col < GlyphWidth; ++col)
+                {
+                    if (Glyphs[glyph][row] & (4 >> col))
+                        fill(pixels, x + col * GlyphScale, y + row * GlyphScale, GlyphScale, GlyphScale, color);
+                }
+            }
+
+            x += (GlyphWidth + 1) * GlyphScale;
+        }
+    }
+
+    int ms_to_pixels(const double ms, const int maxheight)
+    {
+        return min(static_cast<int>(ms * PixelsPerMs + 0.5), maxheight);
+    }
+
+    // Dotted line across a graph at the given time.
+    void draw_guide(ScreenPixel* pixels, const int x0, const int bottom, const int height, const double ms)
+    {
+        const int h = ms_to_pixels(ms, height);
+        if (h == height)
+            return;
+
+        for (int x = x0; x < x0 + GraphWidth; x += 2)
+            pixel(pixels, x, bottom - h) = Gray;
+    }
+}
+
+void draw_overlay(const ProfileHistory& history, ScreenPixel* pixels)
+{
+    const uint64_t count = history.count();
+    if (count == 0)
+        return;
+
+    // Average thread utilization over the most recent frames.
+    FrameProfile profile;
+    uint64_t busy[MaxProfiledThreads] = { 0 };
+    uint64_t view = 0;
+    int numthreads = 0;
+
+    const uint64_t numframes = min<uint64_t>(count, UtilizationFrames);
+    for (uint64_t i = count - numframes; i < count; ++i)
+    {
+        if (!history.read(i, &profile))
+            continue;
+
+        numthreads = min(profile.numthreads, MaxProfiledThreads);
+        view += profile.stages[StageView];
+
+        for (int w = 0; w < numthreads; ++w)
+        {
+            const uint64_t* t = profile.thread(w);
+            busy[w] += t[StageRayCast] + t[StageWallFill] + t[StageSkyFloorFill];
+        }
+    }
+
+    const int panelw = GraphWidth + 2 * Padding;
+    const int panelh =
+        Padding + TextHeight +
+        Padding + FrameGraphHeight +
+        Padding + StageGraphHeight +
+        Padding + numthreads * (ThreadBarHeight + 1) +
+        Padding;
+
+    const int x0 = ScreenWidth - Margin - panelw;
+    const int y0 = ScreenHeight - Margin - panelh;
+    if (x0 < 0 || y0 < 0)
+        return;
+
+    darken(pixels, x0, y0, panelw, panelh);
+
+    const int gx = x0 + Padding;
+    const int texty = y0 + Padding;
+    const int framebottom = texty + TextHeight + Padding + FrameGraphHeight;
+    const int stagebottom = framebottom + Padding + StageGraphHeight;
+    const int threadsy = stagebottom + Padding;
+
+    draw_guide(pixels, gx, framebottom, FrameGraphHeight, TargetMs);
+    draw_guide(pixels, gx, framebottom, FrameGraphHeight, SlowMs);
+    draw_guide(pixels, gx, stagebottom, StageGraphHeight, TargetMs);
+
+    // Most recent frame in the rightmost column.
+    const uint64_t first = count > GraphWidth ? count - GraphWidth : 0;
+    double lastms = 0.0;
+    double maxms = 0.0;
+
+    for (uint64_t i = first; i < count; ++i)
+    {
+        uint64_t stages[NumStages];
+        if (!history.read_stages(i, stages))
+            continue;
+
+        const int x = gx + GraphWidth - static_cast<int>(count - i);
+
+        const double framems = profile_ticks_to_ms(stages[StageFrame]);
+        const ScreenPixel color = framems <= TargetMs ? Green : framems <= SlowMs ? Yellow : Red;
+        const int h = ms_to_pixels(framems, FrameGraphHeight);
+        fill(pixels, x, framebottom - h, 1, h, color);
+
+        lastms = framems;
+        maxms = max(maxms, framems);
+
+        double summs = 0.0;
+        int y = stagebottom;
+        for (int s = 0; s < NumSerialStages; ++s)
+        {
+            summs += profile_ticks_to_ms(stages[SerialStages[s]]);
+            const int top = stagebottom - ms_to_pixels(summs, StageGraphHeight);
+            fill(pixels, x, top, 1, y - top, StageColors[s]);
+            y = top;
+        }
+    }
+
+    // Time of the most recent frame on the left, of the slowest one on the right.
+    char text[32];
+    sprintf(text, "%.1f", lastms);
+    draw_text(pixels, gx, texty, text, White);
+
+    sprintf(text, "%.1f", maxms);
+    draw_text(pixels, gx + GraphWidth - text_width(text), texty, text, maxms <= SlowMs ? White : Red);
+
+    for (int w = 0; w < numthreads; ++w)
+    {
+        const double utilization = view > 0 ? static_cast<double>(busy[w]) / static_cast<double>(view) : 0.0;
+        const int barw = min(static_cast<int>(utilization * GraphWidth + 0.5), GraphWidth);
+        const int y = threadsy + w * (ThreadBarHeight + 1);
+        fill(pixels, gx, y, GraphWidth, ThreadBarHeight, rgb(48, 48, 48));
+        fill(pixels, gx, y, barw, ThreadBarHeight, Green);
+    }
+}
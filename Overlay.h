@@ -0,0 +1,14 @@
+#pragma once
+
+#include "Engine.h"
+#include "Profiler.h"
+
+//
+// Timings of the most recent frames drawn over the bottom right corner of a
+// frame: a scrolling graph of frame times, the serial stages of every frame
+// stacked on top of each other, and how busy every rendering thread was
+// during the 3D view. Only reads the profile history, so it can be drawn
+// while the next frames render.
+//
+
+void draw_overlay(const ProfileHistory& history, ScreenPixel* pixels);
@@ -0,0 +1,141 @@
+#include "AssetPack.h"
+#include "Engine.h"
+
+#include "stb_image.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//
+// Build an asset pack from loose files:
+//
+//   WolfiePack OUTPUT FILE...
+//
+// Every file is packed under its path as given, with forward slashes, so
+// run it from the directory the engine loads loose files from. Images are
+// decoded to RGBA textures and .txt files are text maps: one line per row
+// of cells, top row first, with a digit per cell, 0 for empty and anything
+// else for a wall.
+//
+
+bool ends_with(const string& s, const char* suffix)
+{
+    const size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+bool pack_texture(const char* filepath, PackedAsset* asset)
+{
+    int w, h, n;
+    uint8_t* pixels = stbi_load(filepath, &w, &h, &n, 4);
+    if (pixels == nullptr)
+        return false;
+
+    asset->type = AssetTexture;
+    asset->w = w;
+    asset->h = h;
+    asset->data.assign(pixels, pixels + static_cast<size_t>(w) * h * 4);
+
+    stbi_image_free(pixels);
+
+    return true;
+}
+
+bool pack_map(const char* filepath, PackedAsset* asset)
+{
+    FILE* file = fopen(filepath, "rt");
+    if (file == nullptr)
+        return false;
+
+    Map m;
+    m.w = 0;
+    m.h = 0;
+
+    bool valid = true;
+    char line[4096];
+
+    while (valid && fgets(line, sizeof(line), file) != nullptr)
+    {
+        size_t length = strlen(line);
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            --length;
+
+        if (length == 0)
+            continue;
+
+        if (m.h == 0)
+            m.w = static_cast<int>(length);
+
+        valid = static_cast<int>(length) == m.w;
+
+        for (size_t i = 0; i < length && valid; ++i)
+        {
+            valid = line[i] >= '0' && line[i] <= '9';
+            m.cells.push_back(static_cast<uint8_t>(line[i] - '0'));
+        }
+
+        ++m.h;
+    }
+
+    fclose(file);
+
+    if (!valid || !is_valid_map(m))
+        return false;
+
+    asset->type = AssetMap;
+    asset->w = m.w;
+    asset->h = m.h;
+    asset->data = m.cells;
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s OUTPUT FILE...\n", argv[0]);
+        return 1;
+    }
+
+    vector<PackedAsset> assets(argc - 2);
+
+    for (int i = 2; i < argc; ++i)
+    {
+        PackedAsset& asset = assets[i - 2];
+
+        asset.name = argv[i];
+        for (size_t j = 0; j < asset.name.size(); ++j)
+        {
+            if (asset.name[j] == '\\')
+                asset.name[j] = '/';
+        }
+
+        if (asset.name.size() > static_cast<size_t>(MaxAssetNameLength))
+        {
+            fprintf(stderr, "Name too long: %s\n", argv[i]);
+            return 1;
+        }
+
+        const bool packed = ends_with(asset.name, ".txt") ? pack_map(argv[i], &asset) : pack_texture(argv[i], &asset);
+        if (!packed)
+        {
+            fprintf(stderr, "Failed to pack %s\n", argv[i]);
+            return 1;
+        }
+
+        printf("%-48s %s %ux%u\n", asset.name.c_str(), asset.type == AssetMap ? "map    " : "texture", asset.w, asset.h);
+    }
+
+    if (!write_asset_pack(argv[1], assets))
+    {
+        fprintf(stderr, "Failed to write %s\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "PerfCounters.h"
+
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+bool perfcountersenabled = false;
+
+namespace
+{
+    const char* CounterNames[NumPerfCounters] =
+    {
+        "cycles",
+        "instructions",
+        "llc_misses",
+        "branch_misses"
+    };
+
+#if defined(__linux__)
+
+    const uint64_t CounterConfigs[NumPerfCounters] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    // Counters that open are put in a single group, read with one system call.
+    struct ThreadCounters
+    {
+        bool opened;
+        int leader;
+        int fds[NumPerfCounters];
+        int slots[NumPerfCounters];     // position in the group, -1 if unavailable
+        int numslots;
+
+        ThreadCounters()
+          : opened(false)
+          , leader(-1)
+          , numslots(0)
+        {
+        }
+
+        ~ThreadCounters()
+        {
+            for (int i = 0; i < numslots; ++i)
+                close(fds[i]);
+        }
+
+        void open()
+        {
+            opened = true;
+
+            for (int i = 0; i < NumPerfCounters; ++i)
+            {
+                perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = CounterConfigs[i];
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP;
+
+                const int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+                if (fd < 0)
+                {
+                    slots[i] = -1;
+                    continue;
+                }
+
+                if (leader < 0)
+                    leader = fd;
+
+                fds[numslots] = fd;
+                slots[i] = numslots++;
+            }
+        }
+
+        void read(uint64_t values[NumPerfCounters])
+        {
+            if (!opened)
+                open();
+
+            uint64_t group[1 + NumPerfCounters] = { 0 };
+            if (leader < 0 || ::read(leader, group, sizeof(group)) <= 0)
+            {
+                memset(values, 0, NumPerfCounters * sizeof(uint64_t));
+                return;
+            }
+
+            for (int i = 0; i < NumPerfCounters; ++i)
+                values[i] = slots[i] >= 0 ? group[1 + slots[i]] : 0;
+        }
+    };
+
+    thread_local ThreadCounters threadcounters;
+
+#endif
+}
+
+const char* perf_counter_name(const int counter)
+{
+    return CounterNames[counter];
+}
+
+bool perf_counters_start()
+{
+#if defined(__linux__)
+    uint64_t values[NumPerfCounters];
+    threadcounters.read(values);
+
+    perfcountersenabled = threadcounters.leader >= 0;
+#endif
+
+    return perfcountersenabled;
+}
+
+void perf_counters_read(uint64_t values[NumPerfCounters])
+{
+#if defined(__linux__)
+    threadcounters.read(values);
+#else
+    memset(values, 0, NumPerfCounters * sizeof(uint64_t));
+#endif
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+
+//
+// Hardware performance counters of the calling thread, read with
+// perf_event_open on Linux. Every thread opens its counters the first time
+// it reads them. Elsewhere, or when the kernel does not allow it, counters
+// are unavailable and read as zero.
+//
+
+enum PerfCounter
+{
+    PerfCycles,
+    PerfInstructions,
+    PerfCacheMisses,        // last level cache
+    PerfBranchMisses,
+    NumPerfCounters
+};
+
+const char* perf_counter_name(const int counter);
+
+extern bool perfcountersenabled;
+
+// Enable counting if this thread can open at least one counter.
+bool perf_counters_start();
+
+// Running totals of the counters of the calling thread, in user space only.
+void perf_counters_read(uint64_t values[NumPerfCounters]);
+
+// Add the counts of a scope to target, if counting is enabled.
+class ScopedCounters
+{
+  public:
+    explicit ScopedCounters(uint64_t* target)
+      : m_target(perfcountersenabled ? target : nullptr)
+    {
+        if (m_target != nullptr)
+            perf_counters_read(m_start);
+    }
+
+    ~ScopedCounters()
+    {
+        if (m_target != nullptr)
+        {
+            uint64_t end[NumPerfCounters];
+            perf_counters_read(end);
+
+            for (int i = 0; i < NumPerfCounters; ++i)
+                m_target[i] += end[i] - m_start[i];
+        }
+    }
+
+  private:
+    uint64_t* m_target;
+    uint64_t m_start[NumPerfCounters];
+};
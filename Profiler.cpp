@@ -0,0 +1,355 @@
+#include "Profiler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define HAS_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_RDTSC
+#endif
+
+using namespace std;
+
+namespace
+{
+    const char* StageNames[NumStages] =
+    {
+        "update",
+        "view",
+        "raycast",
+        "wallfill",
+        "skyfloorfill",
+        "minimap",
+        "overlay",
+        "upload",
+        "present",
+        "frame"
+    };
+
+    // Stages that are also timed on every worker.
+    const int ThreadStages[] = { StageRayCast, StageWallFill, StageSkyFloorFill };
+    const int NumThreadStages = sizeof(ThreadStages) / sizeof(ThreadStages[0]);
+
+    double ticks_per_ms = 1.0e6;
+
+    // Where workers past MaxProfiledThreads time and count, discarded, so
+    // that no two threads ever add to the same slot.
+    thread_local uint64_t unprofiled_times[NumStages];
+    thread_local uint64_t unprofiled_counters[NumStages][NumPerfCounters];
+
+    bool ends_with(const char* s, const char* suffix)
+    {
+        const size_t n = strlen(s);
+        const size_t m = strlen(suffix);
+        return n >= m && strcmp(s + n - m, suffix) == 0;
+    }
+}
+
+const char* profile_stage_name(const int stage)
+{
+    return StageNames[stage];
+}
+
+void FrameProfile::clear()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+uint64_t* FrameProfile::thread(const int worker)
+{
+    return worker < MaxProfiledThreads ? threads[worker] : unprofiled_times;
+}
+
+uint64_t* FrameProfile::thread_counters(const int worker, const int stage)
+{
+    return worker < MaxProfiledThreads ? threadcounters[worker][stage] : unprofiled_counters[stage];
+}
+
+void FrameProfile::gather()
+{
+    for (int i = 0; i < NumThreadStages; ++i)
+    {
+        const int stage = ThreadStages[i];
+
+        stages[stage] = 0;
+        for (int w = 0; w < numthreads && w < MaxProfiledThreads; ++w)
+            stages[stage] += threads[w][stage];
+
+        for (int c = 0; c < NumPerfCounters; ++c)
+        {
+            counters[stage][c] = 0;
+            for (int w = 0; w < numthreads && w < MaxProfiledThreads; ++w)
+                counters[stage][c] += threadcounters[w][stage][c];
+        }
+    }
+}
+
+uint64_t profile_now()
+{
+#ifdef HAS_RDTSC
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(
+        chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+void profile_calibrate()
+{
+#ifdef HAS_RDTSC
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const uint64_t startticks = profile_now();
+
+    chrono::steady_clock::time_point end;
+    do
+    {
+        end = chrono::steady_clock::now();
+    } while (end - start < chrono::milliseconds(20));
+
+    const uint64_t endticks = profile_now();
+
+    ticks_per_ms = static_cast<double>(endticks - startticks) / chrono::duration<double, milli>(end - start).count();
+#endif
+}
+
+double profile_ticks_to_ms(const uint64_t ticks)
+{
+    return static_cast<double>(ticks) / ticks_per_ms;
+}
+
+ProfileHistory::ProfileHistory()
+  : m_frames(new FrameProfile[ProfileHistorySize])
+  , m_count(0)
+{
+}
+
+ProfileHistory::~ProfileHistory()
+{
+    delete[] m_frames;
+}
+
+void ProfileHistory::push(const FrameProfile& profile)
+{
+    const uint64_t count = m_count.load(memory_order_relaxed);
+    m_frames[count % ProfileHistorySize] = profile;
+    m_count.store(count + 1, memory_order_release);
+}
+
+uint64_t ProfileHistory::count() const
+{
+    return m_count.load(memory_order_acquire);
+}
+
+bool ProfileHistory::read(const uint64_t index, FrameProfile* profile) const
+{
+    // Frame index gets overwritten as soon as the producer starts writing
+    // frame index + ProfileHistorySize, that is when the count reaches it.
+    const uint64_t count = m_count.load(memory_order_acquire);
+    if (index >= count || count >= index + ProfileHistorySize)
+        return false;
+
+    *profile = m_frames[index % ProfileHistorySize];
+
+    atomic_thread_fence(memory_order_acquire);
+    return m_count.load(memory_order_relaxed) < index + ProfileHistorySize;
+}
+
+bool ProfileHistory::read_stages(const uint64_t index, uint64_t stages[NumStages]) const
+{
+    const uint64_t count = m_count.load(memory_order_acquire);
+    if (index >= count || count >= index + ProfileHistorySize)
+        return false;
+
+    memcpy(stages, m_frames[index % ProfileHistorySize].stages, NumStages * sizeof(uint64_t));
+
+    atomic_thread_fence(memory_order_acquire);
+    return m_count.load(memory_order_relaxed) < index + ProfileHistorySize;
+}
+
+bool ProfileHistory::write(const char* filepath) const
+{
+    return ends_with(filepath, ".json") ? write_json(filepath) : write_csv(filepath);
+}
+
+void ProfileHistory::write_summary(FILE* file) const
+{
+    const uint64_t count = m_count.load(memory_order_acquire);
+    const uint64_t first = count > ProfileHistorySize ? count - ProfileHistorySize + 1 : 0;
+
+    uint64_t totals[NumStages] = { 0 };
+    uint64_t countertotals[NumStages][NumPerfCounters] = { { 0 } };
+    uint64_t numframes = 0;
+
+    FrameProfile* profile = new FrameProfile();
+    for (uint64_t i = first; i < count; ++i)
+    {
+        if (read(i, profile))
+        {
+            for (int s = 0; s < NumStages; ++s)
+            {
+                totals[s] += profile->stages[s];
+                for (int c = 0; c < NumPerfCounters; ++c)
+                    countertotals[s][c] += profile->counters[s][c];
+            }
+            ++numframes;
+        }
+    }
+    delete profile;
+
+    if (numframes == 0)
+        return;
+
+    const double n = static_cast<double>(numframes);
+
+    fprintf(file, "Mean stage times over the last %llu frames:\n", static_cast<unsigned long long>(numframes));
+    for (int s = 0; s < NumStages; ++s)
+        fprintf(file, "  %-13s: %.3f ms\n", StageNames[s], profile_ticks_to_ms(totals[s]) / n);
+
+    if (!perfcountersenabled)
+        return;
+
+    fprintf(file, "\nMean hardware counts per frame:\n");
+    fprintf(file, "  %-13s  %10s  %10s  %5s  %10s  %10s\n", "", "Mcycles", "Minstr", "IPC", "K llc miss", "K br miss");
+    for (int s = 0; s < NumStages; ++s)
+    {
+        const uint64_t* c = countertotals[s];
+        if (c[PerfCycles] == 0 && c[PerfInstructions] == 0)
+            continue;
+
+        fprintf(
+            file,
+            "  %-13s: %10.3f  %10.3f  %5.2f  %10.2f  %10.2f\n",
+            StageNames[s],
+            static_cast<double>(c[PerfCycles]) / n * 1.0e-6,
+            static_cast<double>(c[PerfInstructions]) / n * 1.0e-6,
+            c[PerfCycles] > 0 ? static_cast<double>(c[PerfInstructions]) / static_cast<double>(c[PerfCycles]) : 0.0,
+            static_cast<double>(c[PerfCacheMisses]) / n * 1.0e-3,
+            static_cast<double>(c[PerfBranchMisses]) / n * 1.0e-3);
+    }
+}
+
+bool ProfileHistory::write_csv(const char* filepath) const
+{
+    FILE* file = fopen(filepath, "wt");
+    if (file == nullptr)
+        return false;
+
+    const uint64_t count = m_count.load(memory_order_acquire);
+    const uint64_t first = count > ProfileHistorySize ? count - ProfileHistorySize + 1 : 0;
+
+    int numthreads = 0;
+    FrameProfile* profile = new FrameProfile();
+    for (uint64_t i = first; i < count; ++i)
+    {
+        if (read(i, profile) && profile->numthreads > numthreads)
+            numthreads = profile->numthreads;
+    }
+    numthreads = numthreads < MaxProfiledThreads ? numthreads : MaxProfiledThreads;
+
+    fprintf(file, "frame");
+    for (int s = 0; s < NumStages; ++s)
+        fprintf(file, ",%s_ms", StageNames[s]);
+    if (perfcountersenabled)
+    {
+        for (int s = 0; s < NumStages; ++s)
+        {
+            for (int c = 0; c < NumPerfCounters; ++c)
+                fprintf(file, ",%s_%s", StageNames[s], perf_counter_name(c));
+        }
+    }
+    for (int w = 0; w < numthreads; ++w)
+    {
+        for (int s = 0; s < NumThreadStages; ++s)
+            fprintf(file, ",thread%d_%s_ms", w, StageNames[ThreadStages[s]]);
+    }
+    fprintf(file, "\n");
+
+    for (uint64_t i = first; i < count; ++i)
+    {
+        if (!read(i, profile))
+            continue;
+
+        fprintf(file, "%llu", static_cast<unsigned long long>(profile->frame));
+        for (int s = 0; s < NumStages; ++s)
+            fprintf(file, ",%.4f", profile_ticks_to_ms(profile->stages[s]));
+        if (perfcountersenabled)
+        {
+            for (int s = 0; s < NumStages; ++s)
+            {
+                for (int c = 0; c < NumPerfCounters; ++c)
+                    fprintf(file, ",%llu", static_cast<unsigned long long>(profile->counters[s][c]));
+            }
+        }
+        for (int w = 0; w < numthreads; ++w)
+        {
+            for (int s = 0; s < NumThreadStages; ++s)
+                fprintf(file, ",%.4f", profile_ticks_to_ms(profile->threads[w][ThreadStages[s]]));
+        }
+        fprintf(file, "\n");
+    }
+
+    delete profile;
+
+    return fclose(file) == 0;
+}
+
+bool ProfileHistory::write_json(const char* filepath) const
+{
+    FILE* file = fopen(filepath, "wt");
+    if (file == nullptr)
+        return false;
+
+    const uint64_t count = m_count.load(memory_order_acquire);
+    const uint64_t first = count > ProfileHistorySize ? count - ProfileHistorySize + 1 : 0;
+
+    FrameProfile* profile = new FrameProfile();
+    bool firstframe = true;
+
+    fprintf(file, "{\n  \"unit\": \"ms\",\n  \"frames\": [");
+
+    for (uint64_t i = first; i < count; ++i)
+    {
+        if (!read(i, profile))
+            continue;
+
+        fprintf(file, "%s\n    { \"frame\": %llu", firstframe ? "" : ",", static_cast<unsigned long long>(profile->frame));
+        firstframe = false;
+
+        for (int s = 0; s < NumStages; ++s)
+            fprintf(file, ", \"%s\": %.4f", StageNames[s], profile_ticks_to_ms(profile->stages[s]));
+
+        if (perfcountersenabled)
+        {
+            fprintf(file, ", \"counters\": {");
+            for (int s = 0; s < NumStages; ++s)
+            {
+                fprintf(file, "%s\"%s\": {", s > 0 ? ", " : " ", StageNames[s]);
+                for (int c = 0; c < NumPerfCounters; ++c)
+                    fprintf(file, "%s\"%s\": %llu", c > 0 ? ", " : " ", perf_counter_name(c), static_cast<unsigned long long>(profile->counters[s][c]));
+                fprintf(file, " }");
+            }
+            fprintf(file, " }");
+        }
+
+        fprintf(file, ", \"threads\": [");
+        for (int w = 0; w < profile->numthreads && w < MaxProfiledThreads; ++w)
+        {
+            fprintf(file, "%s{", w > 0 ? ", " : "");
+            for (int s = 0; s < NumThreadStages; ++s)
+                fprintf(file, "%s\"%s\": %.4f", s > 0 ? ", " : " ", StageNames[ThreadStages[s]], profile_ticks_to_ms(profile->threads[w][ThreadStages[s]]));
+            fprintf(file, " }");
+        }
+        fprintf(file, "] }");
+    }
+
+    fprintf(file, "\n  ]\n}\n");
+
+    delete profile;
+
+    return fclose(file) == 0;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "PerfCounters.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+enum ProfileStage
+{
+    StageUpdate,
+    StageView,              // wall time of the whole 3D view
+    StageRayCast,           // summed over workers
+    StageWallFill,          // summed over workers
+    StageSkyFloorFill,      // summed over workers
+    StageMinimap,
+    StageOverlay,
+    StageUpload,
+    StagePresent,
+    StageFrame,             // time since the previous frame was presented
+    NumStages
+};
+
+const char* profile_stage_name(const int stage);
+
+const int MaxProfiledThreads = 32;
+
+// Timings of one frame, in profiler ticks, and hardware counts of the
+// threads running every stage when counters are enabled. Only the first
+// MaxProfiledThreads workers are accounted for, including in the stages
+// summed over workers.
+struct FrameProfile
+{
+    uint64_t frame;
+    int numthreads;
+    uint64_t stages[NumStages];
+    uint64_t threads[MaxProfiledThreads][NumStages];
+    uint64_t counters[NumStages][NumPerfCounters];
+    uint64_t threadcounters[MaxProfiledThreads][NumStages][NumPerfCounters];
+
+    void clear();
+
+    // Per-worker timings of the given worker.
+    uint64_t* thread(const int worker);
+
+    // Per-worker counts of the given worker and stage.
+    uint64_t* thread_counters(const int worker, const int stage);
+
+    // Sum the per-worker timings and counts of the parallel stages into
+    // stages[] and counters[].
+    void gather();
+};
+
+// Read the time stamp counter where available, a monotonic clock otherwise.
+uint64_t profile_now();
+
+// Measure the rate of profile_now(); call once at startup.
+void profile_calibrate();
+
+double profile_ticks_to_ms(const uint64_t ticks);
+
+class ScopedTimer
+{
+  public:
+    explicit ScopedTimer(uint64_t* target)
+      : m_target(target)
+      , m_start(profile_now())
+    {
+    }
+
+    ~ScopedTimer()
+    {
+        *m_target += profile_now() - m_start;
+    }
+
+  private:
+    uint64_t* m_target;
+    uint64_t m_start;
+};
+
+const int ProfileHistorySize = 1024;
+
+//
+// Profiles of the most recent frames. There is a single producer, which never
+// waits; readers detect and skip entries overwritten while they were read.
+//
+
+class ProfileHistory
+{
+  public:
+    ProfileHistory();
+    ~ProfileHistory();
+
+    void push(const FrameProfile& profile);
+
+    // Number of frames pushed so far.
+    uint64_t count() const;
+
+    // Copy frame number index; fails if it is no longer in the history.
+    bool read(const uint64_t index, FrameProfile* profile) const;
+
+    // Copy only the stage timings of frame number index.
+    bool read_stages(const uint64_t index, uint64_t stages[NumStages]) const;
+
+    // Write the history as JSON if the file name ends with .json, as CSV otherwise.
+    bool write(const char* filepath) const;
+
+    // Print the mean time, and counts if enabled, of every stage over the history.
+    void write_summary(FILE* file) const;
+
+  private:
+    FrameProfile* m_frames;
+    std::atomic<uint64_t> m_count;
+
+    bool write_csv(const char* filepath) const;
+    bool write_json(const char* filepath) const;
+};
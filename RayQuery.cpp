@@ -0,0 +1,446 @@
+#include "RayQuery.h"
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HAS_SSE2
+#endif
+
+using namespace std;
+
+namespace
+{
+    // Rays per work-stealing tile.
+    const int RayTileSize = 256;
+
+    enum HitSide
+    {
+        HitOrigin,      // the ray starts in a wall
+        HitX,           // crossing a vertical cell edge
+        HitY            // crossing a horizontal cell edge
+    };
+
+    // Walk state of one ray.
+    struct RayWalk
+    {
+        float x0, y0;
+        float dx, dy;
+        int ix, iy;
+        int stepx, stepy;
+        float tmaxx, tmaxy;     // fraction of the segment at the next vertical and horizontal edges
+        float tdeltax, tdeltay; // fraction of the segment across a cell
+    };
+
+    // Outcome of the walk of one ray.
+    struct RayEnd
+    {
+        bool hit;
+        HitSide side;
+        int ix, iy;
+    };
+
+    // Start a ray in the cell that contains its origin; an origin on a cell
+    // edge belongs to the cell the ray heads into, as in cast_ray(), except
+    // on the left and bottom edges of the map, where it stays in the border
+    // cell so that the walk never leaves the map.
+    void start_walk(const Map& m, const float x0, const float y0, const float x1, const float y1, RayWalk* walk)
+    {
+        myassert(x0 >= 0.0f && x0 < static_cast<float>(m.w));
+        myassert(y0 >= 0.0f && y0 < static_cast<float>(m.h));
+
+        walk->x0 = x0;
+        walk->y0 = y0;
+        walk->dx = x1 - x0;
+        walk->dy = y1 - y0;
+
+        walk->ix = static_cast<int>(x0);
+        walk->iy = static_cast<int>(y0);
+
+        if (x0 == walk->ix && walk->dx < 0.0f && walk->ix > 0)
+            walk->ix -= 1;
+
+        if (y0 == walk->iy && walk->dy < 0.0f && walk->iy > 0)
+            walk->iy -= 1;
+
+        if (walk->dx > 0.0f)
+        {
+            walk->stepx = 1;
+            walk->tmaxx = (walk->ix + 1 - x0) / walk->dx;
+            walk->tdeltax = 1.0f / walk->dx;
+        }
+        else if (walk->dx < 0.0f)
+        {
+            walk->stepx = -1;
+            walk->tmaxx = (walk->ix - x0) / walk->dx;
+            walk->tdeltax = -1.0f / walk->dx;
+        }
+        else
+        {
+            walk->stepx = 0;
+            walk->tmaxx = Infinity;
+            walk->tdeltax = Infinity;
+        }
+
+        if (walk->dy > 0.0f)
+        {
+            walk->stepy = 1;
+            walk->tmaxy = (walk->iy + 1 - y0) / walk->dy;
+            walk->tdeltay = 1.0f / walk->dy;
+        }
+        else if (walk->dy < 0.0f)
+        {
+            walk->stepy = -1;
+            walk->tmaxy = (walk->iy - y0) / walk->dy;
+            walk->tdeltay = -1.0f / walk->dy;
+        }
+        else
+        {
+            walk->stepy = 0;
+            walk->tmaxy = Infinity;
+            walk->tdeltay = Infinity;
+        }
+    }
+
+    // Index of cell (ix, iy) in m.cells.
+    int cell_index(const Map& m, const int ix, const int iy)
+    {
+        return (m.h - 1 - iy) * m.w + ix;
+    }
+
+#ifdef HAS_SSE2
+
+    const int NumLanes = 4;
+
+    __m128i lane_mask(const int bits)
+    {
+        return _mm_set_epi32(-((bits >> 3) & 1), -((bits >> 2) & 1), -((bits >> 1) & 1), -(bits & 1));
+    }
+
+    // Walk state of the rays in every lane, one array per field.
+    struct Lanes
+    {
+        int ix[NumLanes], iy[NumLanes];
+        int index[NumLanes];
+        int stepx[NumLanes], stepy[NumLanes];
+        int stepindexy[NumLanes];
+        float tmaxx[NumLanes], tmaxy[NumLanes];
+        float tdeltax[NumLanes], tdeltay[NumLanes];
+    };
+
+    // Walk rays [0, count) four at a time. Every iteration advances all
+    // lanes by one cell crossing; cells are then looked up one lane at a
+    // time since SSE2 has no gather. A lane whose ray ends is given the
+    // next ray right away, so that short rays do not wait for long ones.
+    // start(i, walk) sets up ray i and finish(i, walk, end) takes its outcome.
+    template <typename Start, typename Finish>
+    void walk_rays(const Map& m, const int count, const Start& start, const Finish& finish)
+    {
+        RayWalk walks[NumLanes];
+        int rays[NumLanes];
+
+        // Lanes without a ray keep looking up a valid cell.
+        Lanes lanes = {};
+
+        int active = 0;
+        int next = 0;
+
+        const uint8_t* cells = m.cells.data();
+        const __m128 one = _mm_set1_ps(1.0f);
+
+        while (true)
+        {
+            // Give every idle lane the next ray that does not start in a wall.
+            for (int l = 0; l < NumLanes; ++l)
+            {
+                while (!((active >> l) & 1) && next < count)
+                {
+                    RayWalk& walk = walks[l];
+                    start(next, &walk);
+
+                    const int index = cell_index(m, walk.ix, walk.iy);
+                    if (cells[index] != 0)
+                    {
+                        const RayEnd end = { true, HitOrigin, walk.ix, walk.iy };
+                        finish(next++, walk, end);
+                        continue;
+                    }
+
+                    rays[l] = next++;
+                    active |= 1 << l;
+
+                    lanes.ix[l] = walk.ix;
+                    lanes.iy[l] = walk.iy;
+                    lanes.index[l] = index;
+                    lanes.stepx[l] = walk.stepx;
+                    lanes.stepy[l] = walk.stepy;
+                    lanes.stepindexy[l] = -walk.stepy * m.w;     // one row up is one row back in m.cells
+                    lanes.tmaxx[l] = walk.tmaxx;
+                    lanes.tmaxy[l] = walk.tmaxy;
+                    lanes.tdeltax[l] = walk.tdeltax;
+                    lanes.tdeltay[l] = walk.tdeltay;
+                }
+            }
+
+            if (active == 0)
+                return;
+
+            __m128i ix = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes.ix));
+            __m128i iy = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes.iy));
+            __m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes.index));
+            const __m128i stepx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes.stepx));
+            const __m128i stepy = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes.stepy));
+            const __m128i stepindexy = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes.stepindexy));
+            __m128 tmaxx = _mm_loadu_ps(lanes.tmaxx);
+            __m128 tmaxy = _mm_loadu_ps(lanes.tmaxy);
+            const __m128 tdeltax = _mm_loadu_ps(lanes.tdeltax);
+            const __m128 tdeltay = _mm_loadu_ps(lanes.tdeltay);
+            const __m128i activemask = lane_mask(active);
+
+            int done = 0;
+            int past = 0;
+            int xsides = 0;
+
+            while (done == 0)
+            {
+                // Lanes crossing a vertical edge, and lanes crossing a horizontal one.
+                const __m128 xsidef = _mm_cmplt_ps(tmaxx, tmaxy);
+                const __m128i xside = _mm_castps_si128(xsidef);
+                const __m128i movex = _mm_and_si128(xside, activemask);
+                const __m128i movey = _mm_andnot_si128(xside, activemask);
+
+                const __m128 t = _mm_or_ps(_mm_and_ps(xsidef, tmaxx), _mm_andnot_ps(xsidef, tmaxy));
+
+                ix = _mm_add_epi32(ix, _mm_and_si128(movex, stepx));
+                iy = _mm_add_epi32(iy, _mm_and_si128(movey, stepy));
+                index = _mm_add_epi32(index, _mm_or_si128(_mm_and_si128(movex, stepx), _mm_and_si128(movey, stepindexy)));
+
+                tmaxx = _mm_add_ps(tmaxx, _mm_and_ps(_mm_castsi128_ps(movex), tdeltax));
+                tmaxy = _mm_add_ps(tmaxy, _mm_and_ps(_mm_castsi128_ps(movey), tdeltay));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes.index), index);
+
+                const int walls =
+                    ((cells[lanes.index[0]] != 0 ? 1 : 0) |
+                     (cells[lanes.index[1]] != 0 ? 2 : 0) |
+                     (cells[lanes.index[2]] != 0 ? 4 : 0) |
+                     (cells[lanes.index[3]] != 0 ? 8 : 0)) & active;
+
+                past = _mm_movemask_ps(_mm_cmpgt_ps(t, one)) & active;
+                done = past | walls;
+                xsides = _mm_movemask_ps(xsidef);
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes.ix), ix);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes.iy), iy);
+            _mm_storeu_ps(lanes.tmaxx, tmaxx);
+            _mm_storeu_ps(lanes.tmaxy, tmaxy);
+
+            for (int l = 0; l < NumLanes; ++l)
+            {
+                if (!((done >> l) & 1))
+                    continue;
+
+                const RayEnd end =
+                {
+                    !((past >> l) & 1),
+                    (xsides >> l) & 1 ? HitX : HitY,
+                    lanes.ix[l],
+                    lanes.iy[l]
+                };
+
+                finish(rays[l], walks[l], end);
+            }
+
+            active &= ~done;
+        }
+    }
+
+#else
+
+    // Walk rays [0, count) one at a time until they enter a wall or go past
+    // the end of their segment.
+    template <typename Start, typename Finish>
+    void walk_rays(const Map& m, const int count, const Start& start, const Finish& finish)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            RayWalk walk;
+            start(i, &walk);
+
+            const RayWalk first = walk;
+            RayEnd end = { true, HitOrigin, walk.ix, walk.iy };
+
+            if (m.cells[cell_index(m, walk.ix, walk.iy)] == 0)
+            {
+                while (true)
+                {
+                    float t;
+                    if (walk.tmaxx < walk.tmaxy)
+                    {
+                        t = walk.tmaxx;
+                        walk.ix += walk.stepx;
+                        walk.tmaxx += walk.tdeltax;
+                        end.side = HitX;
+                    }
+                    else
+                    {
+                        t = walk.tmaxy;
+                        walk.iy += walk.stepy;
+                        walk.tmaxy += walk.tdeltay;
+                        end.side = HitY;
+                    }
+
+                    if (t > 1.0f)
+                    {
+                        end.hit = false;
+                        break;
+                    }
+
+                    if (m.cells[cell_index(m, walk.ix, walk.iy)] != 0)
+                        break;
+                }
+
+                end.ix = walk.ix;
+                end.iy = walk.iy;
+            }
+
+            finish(i, first, end);
+        }
+    }
+
+#endif
+
+    // Point where a ray hit: on the edge of the wall cell it entered, or at
+    // its origin if it started in a wall.
+    void hit_point(const RayWalk& walk, const RayEnd& end, float* hx, float* hy)
+    {
+        myassert(end.hit);
+
+        if (end.side == HitX)
+        {
+            *hx = static_cast<float>(walk.stepx > 0 ? end.ix : end.ix + 1);
+            *hy = walk.y0 + (*hx - walk.x0) / walk.dx * walk.dy;
+        }
+        else if (end.side == HitY)
+        {
+            *hy = static_cast<float>(walk.stepy > 0 ? end.iy : end.iy + 1);
+            *hx = walk.x0 + (*hy - walk.y0) / walk.dy * walk.dx;
+        }
+        else
+        {
+            *hx = walk.x0;
+            *hy = walk.y0;
+        }
+    }
+
+    void cast_ray_range(const Map& m, const RayBatch& rays, const RayHits& hits, const int begin, const int end)
+    {
+        walk_rays(
+            m,
+            end - begin,
+            [&m, &rays, begin](const int j, RayWalk* walk)
+            {
+                const int i = begin + j;
+                start_walk(m, rays.x0[i], rays.y0[i], rays.x1[i], rays.y1[i], walk);
+            },
+            [&m, &rays, &hits, begin](const int j, const RayWalk& walk, const RayEnd& rayend)
+            {
+                const int i = begin + j;
+
+                float hx, hy;
+                if (rayend.hit)
+                    hit_point(walk, rayend, &hx, &hy);
+                else
+                {
+                    hx = rays.x1[i];
+                    hy = rays.y1[i];
+                }
+
+                if (hits.hit != nullptr)
+                    hits.hit[i] = rayend.hit ? 1 : 0;
+
+                if (hits.x != nullptr)
+                    hits.x[i] = hx;
+
+                if (hits.y != nullptr)
+                    hits.y[i] = hy;
+
+                if (hits.distance != nullptr)
+                    hits.distance[i] = sqrt((hx - walk.x0) * (hx - walk.x0) + (hy - walk.y0) * (hy - walk.y0));
+
+                if (hits.cell != nullptr)
+                    hits.cell[i] = rayend.hit ? rayend.iy * m.w + rayend.ix : -1;
+            });
+    }
+
+    void scan_lidar_range(
+        const Map& m,
+        const LidarPoses& poses,
+        const int numbeams,
+        const float range,
+        float* distances,
+        const int begin, const int end)
+    {
+        walk_rays(
+            m,
+            end - begin,
+            [&m, &poses, numbeams, range, begin](const int j, RayWalk* walk)
+            {
+                const int i = begin + j;
+                const int pose = i / numbeams;
+                const int beam = i - pose * numbeams;
+                const float a = poses.a[pose] + 2.0f * Pi * beam / numbeams;
+
+                const float x0 = poses.x[pose];
+                const float y0 = poses.y[pose];
+                start_walk(m, x0, y0, x0 + range * cos(a), y0 + range * sin(a), walk);
+            },
+            [range, distances, begin](const int j, const RayWalk& walk, const RayEnd& rayend)
+            {
+                float d = range;
+
+                if (rayend.hit)
+                {
+                    float hx, hy;
+                    hit_point(walk, rayend, &hx, &hy);
+
+                    const float dx = hx - walk.x0;
+                    const float dy = hy - walk.y0;
+                    d = min(sqrt(dx * dx + dy * dy), range);
+                }
+
+                distances[begin + j] = d;
+            });
+    }
+}
+
+void cast_rays(Engine* engine, const Map& m, const RayBatch& rays, const RayHits& hits)
+{
+    TraceScope scope("cast rays");
+
+    engine->pool.parallel_for(rays.count, RayTileSize, [&m, &rays, &hits](const int begin, const int end, const int worker)
+    {
+        cast_ray_range(m, rays, hits, begin, end);
+    });
+}
+
+void scan_lidar(
+    Engine* engine,
+    const Map& m,
+    const LidarPoses& poses,
+    const int numbeams,
+    const float range,
+    float* distances)
+{
+    TraceScope scope("lidar");
+
+    engine->pool.parallel_for(poses.count * numbeams, RayTileSize, [&m, &poses, numbeams, range, distances](const int begin, const int end, const int worker)
+    {
+        scan_lidar_range(m, poses, numbeams, range, distances, begin, end);
+    });
+}
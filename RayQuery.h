@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Engine.h"
+
+#include <cstdint>
+
+//
+// Batched ray queries against a map, for line of sight checks and range
+// sensors. Rays walk the grid one cell crossing at a time like cast_ray(),
+// four at a time with SSE2 where available, and batches are spread over the
+// thread pool of the engine. Results agree with cast_ray() up to rounding.
+//
+
+// Segments from (x0, y0) to (x1, y1), one array per coordinate. Origins must
+// lie inside the map; rays starting in a wall hit it at their origin.
+struct RayBatch
+{
+    int count;
+    const float* x0;
+    const float* y0;
+    const float* x1;
+    const float* y1;
+};
+
+// Results of a batch, one array per field; any of them may be null.
+struct RayHits
+{
+    uint8_t* hit;       // whether a wall was hit before the end of the segment
+    float* x;           // hit point, or end of the segment
+    float* y;
+    float* distance;    // from the origin to the hit point, or length of the segment
+    int* cell;          // wall cell hit as iy * m.w + ix, -1 otherwise
+};
+
+void cast_rays(Engine* engine, const Map& m, const RayBatch& rays, const RayHits& hits);
+
+// Positions and headings of range sensors, one array per field.
+struct LidarPoses
+{
+    int count;
+    const float* x;
+    const float* y;
+    const float* a;
+};
+
+// Cast numbeams beams evenly around every pose, the first one along its
+// heading and the others counterclockwise, and write the distance to the
+// first wall hit by each, or range if there is none within range, to
+// distances[pose * numbeams + beam].
+void scan_lidar(
+    Engine* engine,
+    const Map& m,
+    const LidarPoses& poses,
+    const int numbeams,
+    const float range,
+    float* distances);
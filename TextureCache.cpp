@@ -0,0 +1,121 @@
+#include "TextureCache.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static_assert(sizeof(TextureCacheHeader) <= TextureCacheDataOffset, "the header of a texture cache must fit before its texels");
+
+namespace
+{
+    const char Magic[4] = { 'W', 'T', 'E', 'X' };
+
+    atomic<unsigned> tempcount(0);
+
+    int process_id()
+    {
+#if defined(_WIN32)
+        return _getpid();
+#else
+        return static_cast<int>(getpid());
+#endif
+    }
+}
+
+uint64_t fnv1a(const uint8_t* data, const size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+string texture_cache_path(const char* filepath)
+{
+    return string(filepath) + ".cache";
+}
+
+bool open_texture_cache(const char* cachepath, const MappedFile* source, MappedFile* cache, TextureCacheHeader* header)
+{
+    if (!cache->open(cachepath))
+        return false;
+
+    if (cache->size() < TextureCacheDataOffset)
+    {
+        cache->close();
+        return false;
+    }
+
+    memcpy(header, cache->data(), sizeof(*header));
+
+    bool valid =
+        memcmp(header->magic, Magic, sizeof(Magic)) == 0 &&
+        header->version == TextureCacheVersion &&
+        header->w > 0 &&
+        header->h > 0 &&
+        cache->size() >= TextureCacheDataOffset + static_cast<size_t>(header->w) * header->h * 4;
+
+    // Only hash the source once the cache looks usable.
+    if (valid && source != nullptr)
+    {
+        valid =
+            header->sourcesize == source->size() &&
+            header->sourcehash == fnv1a(source->data(), source->size());
+    }
+
+    if (!valid)
+        cache->close();
+
+    return valid;
+}
+
+bool write_texture_cache(const char* cachepath, const TextureCacheHeader& header, const uint8_t* texels)
+{
+    // Unique to the writer, so that processes and threads rebuilding the
+    // same cache at once never write into the same file.
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%d.%u.tmp", process_id(), tempcount.fetch_add(1));
+    const string temppath = string(cachepath) + suffix;
+
+    FILE* file = fopen(temppath.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    TextureCacheHeader h = header;
+    memcpy(h.magic, Magic, sizeof(Magic));
+    h.version = TextureCacheVersion;
+
+    uint8_t padding[TextureCacheDataOffset - sizeof(TextureCacheHeader)] = {};
+
+    bool success =
+        fwrite(&h, sizeof(h), 1, file) == 1 &&
+        fwrite(padding, sizeof(padding), 1, file) == 1 &&
+        fwrite(texels, static_cast<size_t>(h.w) * h.h * 4, 1, file) == 1;
+
+    success = fclose(file) == 0 && success;
+
+#if defined(_WIN32)
+    // Renaming does not replace an existing file on Windows; a cache still
+    // mapped by another process cannot be removed and is left as it is.
+    remove(cachepath);
+#endif
+    success = success && rename(temppath.c_str(), cachepath) == 0;
+
+    if (!success)
+        remove(temppath.c_str());
+
+    return success;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//
+// Decoded textures, cached next to their source image so that loading them
+// maps the texels instead of decoding the image. A cache file is a
+// TextureCacheHeader followed, at TextureCacheDataOffset, by w x h RGBA
+// texels in the layout the renderer samples them in, top row first. It is
+// valid while the size and the FNV-1a hash of the source image match the
+// ones in its header.
+//
+
+struct TextureCacheHeader
+{
+    char magic[4];          // "WTEX"
+    uint32_t version;
+    uint64_t sourcesize;
+    uint64_t sourcehash;
+    uint32_t w, h;
+    uint32_t n;             // channels of the source image
+    uint32_t reserved;
+};
+
+const uint32_t TextureCacheVersion = 1;
+
+// Texels start on a cache line boundary.
+const size_t TextureCacheDataOffset = 64;
+
+uint64_t fnv1a(const uint8_t* data, const size_t size);
+
+// Path of the cache of an image.
+std::string texture_cache_path(const char* filepath);
+
+// Map the cache at cachepath and check it against the source image, unless
+// source is null. Returns false if the cache is missing or out of date.
+bool open_texture_cache(const char* cachepath, const MappedFile* source, MappedFile* cache, TextureCacheHeader* header);
+
+// Write a cache through a temporary file unique to the writer renamed into
+// place, so that other processes never map a partial or mixed one.
+bool write_texture_cache(const char* cachepath, const TextureCacheHeader& header, const uint8_t* texels);
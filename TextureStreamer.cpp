@@ -0,0 +1,288 @@
+#include "TextureStreamer.h"
+
+#include "Engine.h"
+#include "Trace.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+    const uint8_t UnloadedColor[4] = { 128, 128, 128, 255 };
+
+    size_t texture_bytes(const Texture& tex)
+    {
+        return static_cast<size_t>(tex.w) * tex.h * 4;
+    }
+
+    // Average color of a texture, computed on the I/O thread, which also
+    // brings the pages of mapped texels in before the texture is drawn.
+    void average_color(const Texture& tex, uint8_t* color)
+    {
+        uint64_t sum[4] = { 0, 0, 0, 0 };
+        const size_t count = static_cast<size_t>(tex.w) * tex.h;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            for (int c = 0; c < 4; ++c)
+                sum[c] += tex.data[i * 4 + c];
+        }
+
+        for (int c = 0; c < 4; ++c)
+            color[c] = static_cast<uint8_t>(count > 0 ? sum[c] / count : UnloadedColor[c]);
+    }
+}
+
+TextureStreamer::TextureStreamer()
+  : m_names(nullptr)
+  , m_pack(nullptr)
+  , m_budget(0)
+  , m_residentbytes(0)
+  , m_slots(nullptr)
+  , m_numslots(0)
+  , m_frame(1)
+  , m_quit(false)
+{
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    stop();
+}
+
+void TextureStreamer::start(const char* const* names, const int count, const AssetPack* pack, const size_t budget)
+{
+    stop();
+
+    m_names = names;
+    m_pack = pack;
+    m_budget = budget;
+    m_residentbytes = 0;
+    m_frame = 1;
+
+    m_numslots = count;
+    m_slots = new Slot[count];
+
+    for (int i = 0; i < count; ++i)
+    {
+        Slot& slot = m_slots[i];
+
+        memcpy(slot.average, UnloadedColor, sizeof(slot.average));
+
+        slot.placeholder = new Texture();
+        slot.placeholder->w = 1;
+        slot.placeholder->h = 1;
+        slot.placeholder->n = 4;
+        slot.placeholder->data = slot.average;
+        slot.placeholder->pixels = nullptr;
+
+        slot.resident = nullptr;
+        slot.current = slot.placeholder;
+        slot.loading = false;
+        slot.failed = false;
+        slot.lastused.store(0, memory_order_relaxed);
+    }
+
+    m_quit = false;
+    m_thread = thread(&TextureStreamer::thread_main, this);
+}
+
+void TextureStreamer::stop()
+{
+    if (m_slots == nullptr)
+        return;
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_quit = true;
+        m_requests.clear();
+    }
+
+    m_wakeup.notify_one();
+    m_thread.join();
+
+    for (size_t i = 0; i < m_loaded.size(); ++i)
+    {
+        if (m_loaded[i].tex != nullptr)
+        {
+            free_texture(m_loaded[i].tex);
+            delete m_loaded[i].tex;
+        }
+    }
+
+    m_loaded.clear();
+
+    for (int i = 0; i < m_numslots; ++i)
+    {
+        evict(m_slots[i]);
+        delete m_slots[i].placeholder;
+    }
+
+    delete[] m_slots;
+    m_slots = nullptr;
+    m_numslots = 0;
+}
+
+bool TextureStreamer::is_started() const
+{
+    return m_slots != nullptr;
+}
+
+const Texture& TextureStreamer::use(const int index) const
+{
+    Slot& slot = m_slots[index];
+
+    // Only write when the value changes so that threads drawing the same
+    // texture do not keep taking its cache line from each other.
+    if (slot.lastused.load(memory_order_relaxed) != m_frame)
+        slot.lastused.store(m_frame, memory_order_relaxed);
+
+    return *slot.current;
+}
+
+void TextureStreamer::update()
+{
+    if (m_slots == nullptr)
+        return;
+
+    TraceScope scope("update textures");
+
+    vector<Loaded> loaded;
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+        loaded.swap(m_loaded);
+    }
+
+    for (size_t i = 0; i < loaded.size(); ++i)
+    {
+        Slot& slot = m_slots[loaded[i].index];
+        slot.loading = false;
+
+        if (loaded[i].tex == nullptr)
+        {
+            slot.failed = true;
+            continue;
+        }
+
+        memcpy(slot.average, loaded[i].average, sizeof(slot.average));
+        slot.resident = loaded[i].tex;
+        slot.current = slot.resident;
+        m_residentbytes += texture_bytes(*slot.resident);
+    }
+
+    const uint64_t lastframe = m_frame;
+
+    bool requested = false;
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+
+        for (int i = 0; i < m_numslots; ++i)
+        {
+            Slot& slot = m_slots[i];
+
+            if (slot.lastused.load(memory_order_relaxed) == lastframe && slot.resident == nullptr && !slot.loading && !slot.failed)
+            {
+                slot.loading = true;
+                m_requests.push_back(i);
+                requested = true;
+            }
+        }
+    }
+
+    if (requested)
+        m_wakeup.notify_one();
+
+    // Evict the least recently used textures, sparing the ones of the last frame.
+    while (m_residentbytes > m_budget)
+    {
+        Slot* victim = nullptr;
+
+        for (int i = 0; i < m_numslots; ++i)
+        {
+            Slot& slot = m_slots[i];
+            const uint64_t lastused = slot.lastused.load(memory_order_relaxed);
+
+            if (slot.resident != nullptr &&
+                lastused < lastframe &&
+                (victim == nullptr || lastused < victim->lastused.load(memory_order_relaxed)))
+                victim = &slot;
+        }
+
+        if (victim == nullptr)
+            break;
+
+        evict(*victim);
+    }
+
+    ++m_frame;
+}
+
+size_t TextureStreamer::resident_bytes() const
+{
+    return m_residentbytes;
+}
+
+void TextureStreamer::thread_main()
+{
+    trace_register_thread("texture streaming");
+
+    while (true)
+    {
+        int index;
+
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this]() { return m_quit || !m_requests.empty(); });
+
+            if (m_quit)
+                return;
+
+            index = m_requests.front();
+            m_requests.pop_front();
+        }
+
+        Loaded result;
+        result.index = index;
+        result.tex = new Texture();
+        result.tex->data = nullptr;
+        result.tex->pixels = nullptr;
+
+        {
+            TraceScope scope("load texture", index);
+
+            const bool success =
+                m_pack != nullptr
+                    ? load_texture(result.tex, *m_pack, m_names[index])
+                    : load_texture(result.tex, m_names[index]);
+
+            if (success)
+                average_color(*result.tex, result.average);
+            else
+            {
+                free_texture(result.tex);
+                delete result.tex;
+                result.tex = nullptr;
+            }
+        }
+
+        lock_guard<mutex> lock(m_mutex);
+        m_loaded.push_back(result);
+    }
+}
+
+void TextureStreamer::evict(Slot& slot)
+{
+    if (slot.resident == nullptr)
+        return;
+
+    m_residentbytes -= texture_bytes(*slot.resident);
+
+    free_texture(slot.resident);
+    delete slot.resident;
+
+    slot.resident = nullptr;
+    slot.current = slot.placeholder;
+}
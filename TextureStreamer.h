@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class AssetPack;
+struct Texture;
+
+//
+// Textures loaded on demand by a background I/O thread and unloaded, least
+// recently used first, while more than a budget of texels is resident.
+//
+// Rendering threads get textures with use(), which never waits: until a
+// texture is resident they get a 1x1 placeholder of its average color, or
+// of a neutral grey before it was ever loaded. Textures used during a frame
+// are queued for loading by the next update(), which runs between frames,
+// when no thread reads textures, and is the only place textures are made
+// resident or evicted.
+//
+
+class TextureStreamer
+{
+  public:
+    TextureStreamer();
+    ~TextureStreamer();
+
+    // Stream count textures, named as in TextureFilePaths, from pack if it is
+    // not null and from files otherwise. The names and the pack must outlive
+    // the streamer.
+    void start(const char* const* names, const int count, const AssetPack* pack, const size_t budget);
+    void stop();
+
+    bool is_started() const;
+
+    // Texture to draw texture index with in the current frame. Safe to call
+    // from any number of threads during a frame.
+    const Texture& use(const int index) const;
+
+    // Make loaded textures resident, queue loads of the textures used since
+    // the last update, and evict textures not used since the update before
+    // while over budget. A working set larger than the budget stays resident.
+    void update();
+
+    size_t resident_bytes() const;
+
+  private:
+    struct Slot
+    {
+        Texture* resident;                  // null until loaded and once evicted
+        Texture* placeholder;
+        const Texture* current;             // resident or placeholder
+        uint8_t average[4];                 // texel of the placeholder
+        bool loading;
+        bool failed;                        // not retried
+        std::atomic<uint64_t> lastused;     // last frame the texture was used in, 0 if never
+    };
+
+    struct Loaded
+    {
+        int index;
+        Texture* tex;                       // null if the texture could not be loaded
+        uint8_t average[4];
+    };
+
+    const char* const* m_names;
+    const AssetPack* m_pack;
+    size_t m_budget;
+    size_t m_residentbytes;
+
+    Slot* m_slots;
+    int m_numslots;
+    uint64_t m_frame;                       // current frame, counted from 1
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::deque<int> m_requests;
+    std::vector<Loaded> m_loaded;
+    bool m_quit;
+
+    TextureStreamer(const TextureStreamer&);
+    TextureStreamer& operator=(const TextureStreamer&);
+
+    void thread_main();
+    void evict(Slot& slot);
+};
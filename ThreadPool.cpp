@@ -0,0 +1,284 @@
+#include "ThreadPool.h"
+
+#include "Trace.h"
+
+#include <climits>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    uint64_t pack_range(const uint32_t begin, const uint32_t end)
+    {
+        return (static_cast<uint64_t>(begin) << 32) | end;
+    }
+
+    uint32_t range_begin(const uint64_t range)
+    {
+        return static_cast<uint32_t>(range >> 32);
+    }
+
+    uint32_t range_end(const uint64_t range)
+    {
+        return static_cast<uint32_t>(range);
+    }
+}
+
+ThreadPool::ThreadPool()
+  : m_workers(nullptr)
+  , m_numthreads(1)
+  , m_generation(0)
+  , m_active(0)
+  , m_quit(false)
+  , m_func(nullptr)
+  , m_context(nullptr)
+  , m_count(0)
+  , m_tilesize(1)
+  , m_remaining(0)
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop();
+}
+
+void ThreadPool::start(const int numthreads, const int* cpus, const int numcpus)
+{
+    stop();
+
+    m_numthreads = numthreads > 1 ? numthreads : 1;
+    m_workers = new Worker[m_numthreads];
+    for (int i = 0; i < m_numthreads; ++i)
+        m_workers[i].range.store(0, memory_order_relaxed);
+
+    m_generation = 0;
+    m_active = 0;
+    m_quit = false;
+
+    if (numcpus > 0)
+        pin_current_thread(cpus[0]);
+
+    for (int i = 1; i < m_numthreads; ++i)
+    {
+        const int cpu = numcpus > 0 ? cpus[i % numcpus] : -1;
+        m_threads.push_back(thread(&ThreadPool::thread_main, this, i, cpu));
+    }
+}
+
+void ThreadPool::stop()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wakeup.notify_all();
+
+    for (size_t i = 0; i < m_threads.size(); ++i)
+        m_threads[i].join();
+    m_threads.clear();
+
+    delete[] m_workers;
+    m_workers = nullptr;
+    m_numthreads = 1;
+}
+
+int ThreadPool::thread_count() const
+{
+    return m_numthreads;
+}
+
+void ThreadPool::run(const int count, const int tilesize, TaskFunc func, void* context)
+{
+    if (count <= 0)
+        return;
+
+    const int numtiles = (count + tilesize - 1) / tilesize;
+
+    if (m_numthreads == 1 || numtiles == 1)
+    {
+        for (int begin = 0; begin < count; begin += tilesize)
+            func(context, begin, begin + tilesize < count ? begin + tilesize : count, 0);
+        return;
+    }
+
+    {
+        // Wait for stragglers of the previous job to leave before dealing new tiles.
+        unique_lock<mutex> lock(m_mutex);
+        m_done.wait(lock, [this]() { return m_active == 0; });
+
+        m_func = func;
+        m_context = context;
+        m_count = count;
+        m_tilesize = tilesize;
+
+        for (int i = 0; i < m_numthreads; ++i)
+        {
+            const uint32_t begin = static_cast<uint32_t>(static_cast<int64_t>(numtiles) * i / m_numthreads);
+            const uint32_t end = static_cast<uint32_t>(static_cast<int64_t>(numtiles) * (i + 1) / m_numthreads);
+            m_workers[i].range.store(pack_range(begin, end), memory_order_relaxed);
+        }
+
+        m_remaining.store(numtiles, memory_order_relaxed);
+        ++m_generation;
+    }
+    m_wakeup.notify_all();
+
+    work(0, func, context, count, tilesize);
+
+    if (m_remaining.load(memory_order_acquire) != 0)
+    {
+        unique_lock<mutex> lock(m_mutex);
+        m_done.wait(lock, [this]() { return m_remaining.load(memory_order_acquire) == 0; });
+    }
+}
+
+bool ThreadPool::pin_current_thread(const int cpu)
+{
+    if (cpu < 0 || cpu >= cpu_limit())
+        return false;
+
+#if defined(_WIN32)
+    return SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+int ThreadPool::cpu_limit()
+{
+#if defined(_WIN32)
+    // Affinity masks only reach the CPUs of the current processor group.
+    return static_cast<int>(sizeof(DWORD_PTR) * 8);
+#elif defined(__linux__)
+    return CPU_SETSIZE;
+#else
+    return INT_MAX;
+#endif
+}
+
+void ThreadPool::thread_main(const int worker, const int cpu)
+{
+    if (cpu >= 0)
+        pin_current_thread(cpu);
+
+    trace_register_thread("worker", worker);
+
+    uint64_t seen = 0;
+
+    while (true)
+    {
+        TaskFunc func;
+        void* context;
+        int count, tilesize;
+
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this, seen]() { return m_quit || m_generation != seen; });
+
+            if (m_quit)
+                return;
+
+            seen = m_generation;
+            ++m_active;
+
+            func = m_func;
+            context = m_context;
+            count = m_count;
+            tilesize = m_tilesize;
+        }
+
+        work(worker, func, context, count, tilesize);
+
+        {
+            lock_guard<mutex> lock(m_mutex);
+            --m_active;
+        }
+        m_done.notify_all();
+    }
+}
+
+void ThreadPool::work(const int worker, TaskFunc func, void* context, const int count, const int tilesize)
+{
+    int tile;
+    while (pop(worker, &tile) || steal(worker, &tile))
+    {
+        const int begin = tile * tilesize;
+        const int end = begin + tilesize < count ? begin + tilesize : count;
+        func(context, begin, end, worker);
+
+        if (m_remaining.fetch_sub(1, memory_order_acq_rel) == 1)
+        {
+            // Take the lock so that the notification cannot slip in between
+            // the waiter checking its predicate and going to sleep.
+            { lock_guard<mutex> lock(m_mutex); }
+            m_done.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::pop(const int worker, int* tile)
+{
+    atomic<uint64_t>& range = m_workers[worker].range;
+
+    uint64_t r = range.load(memory_order_acquire);
+    while (true)
+    {
+        const uint32_t begin = range_begin(r);
+        const uint32_t end = range_end(r);
+
+        if (begin >= end)
+            return false;
+
+        if (range.compare_exchange_weak(r, pack_range(begin + 1, end), memory_order_acq_rel, memory_order_acquire))
+        {
+            *tile = static_cast<int>(begin);
+            return true;
+        }
+    }
+}
+
+bool ThreadPool::steal(const int worker, int* tile)
+{
+    for (int i = 1; i < m_numthreads; ++i)
+    {
+        const int victim = (worker + i) % m_numthreads;
+        atomic<uint64_t>& range = m_workers[victim].range;
+
+        uint64_t r = range.load(memory_order_acquire);
+        while (true)
+        {
+            const uint32_t begin = range_begin(r);
+            const uint32_t end = range_end(r);
+
+            if (begin >= end)
+                break;
+
+            // Take the upper half of the victim's remaining tiles.
+            const uint32_t stolen = (end - begin + 1) / 2;
+            if (range.compare_exchange_weak(r, pack_range(begin, end - stolen), memory_order_acq_rel, memory_order_acquire))
+            {
+                *tile = static_cast<int>(end - stolen);
+                if (stolen > 1)
+                    m_workers[worker].range.store(pack_range(end - stolen + 1, end), memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Persistent pool of worker threads with work stealing over tiles.
+//
+// The range [0, count) of a job is cut into tiles which are dealt out evenly to
+// all workers; a worker that runs out of tiles steals half of the remaining
+// tiles of another worker. The thread calling run() takes part as worker 0.
+// Idle workers block on a condition variable instead of spinning.
+//
+
+class ThreadPool
+{
+  public:
+    typedef void (*TaskFunc)(void* context, int begin, int end, int worker);
+
+    ThreadPool();
+    ~ThreadPool();
+
+    // Start numthreads - 1 background threads. If numcpus > 0, worker i is
+    // pinned to CPU cpus[i % numcpus]; this includes the calling thread.
+    void start(const int numthreads, const int* cpus = nullptr, const int numcpus = 0);
+    void stop();
+
+    int thread_count() const;
+
+    // Run func over every tile of [0, count) and wait for completion.
+    void run(const int count, const int tilesize, TaskFunc func, void* context);
+
+    template <typename Func>
+    void parallel_for(const int count, const int tilesize, const Func& func)
+    {
+        run(count, tilesize, &invoke<Func>, const_cast<Func*>(&func));
+    }
+
+    // Pin the calling thread to a CPU in [0, cpu_limit()).
+    static bool pin_current_thread(const int cpu);
+    static int cpu_limit();
+
+  private:
+    struct Worker
+    {
+        // Remaining tiles of this worker: first tile in the high 32 bits,
+        // one past the last tile in the low 32 bits.
+        std::atomic<uint64_t> range;
+        uint8_t padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    std::vector<std::thread> m_threads;
+    Worker* m_workers;
+    int m_numthreads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::condition_variable m_done;
+    uint64_t m_generation;
+    int m_active;
+    bool m_quit;
+
+    TaskFunc m_func;
+    void* m_context;
+    int m_count;
+    int m_tilesize;
+    std::atomic<int> m_remaining;
+
+    template <typename Func>
+    static void invoke(void* context, int begin, int end, int worker)
+    {
+        (*static_cast<Func*>(context))(begin, end, worker);
+    }
+
+    void thread_main(const int worker, const int cpu);
+    void work(const int worker, TaskFunc func, void* context, const int count, const int tilesize);
+    bool pop(const int worker, int* tile);
+    bool steal(const int worker, int* tile);
+};
@@ -0,0 +1,151 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+bool traceenabled = false;
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char* name;
+        uint64_t begin;
+        uint64_t end;
+        int arg;
+    };
+
+    struct ThreadTrace
+    {
+        char name[32];
+        TraceEvent* events;
+        int count;
+        int dropped;
+    };
+
+    ThreadTrace threadtraces[MaxTraceThreads];
+    atomic<int> numthreadtraces(0);
+    thread_local ThreadTrace* currenttrace = nullptr;
+
+    int capacity = 0;
+    uint64_t starttime = 0;
+
+    double ticks_to_us(const uint64_t ticks)
+    {
+        return profile_ticks_to_ms(ticks) * 1000.0;
+    }
+}
+
+void trace_start(const int eventsperthread)
+{
+    capacity = eventsperthread;
+    starttime = profile_now();
+    traceenabled = true;
+}
+
+void trace_register_thread(const char* name, const int index)
+{
+    if (!traceenabled || currenttrace != nullptr)
+        return;
+
+    const int slot = numthreadtraces.fetch_add(1);
+    if (slot >= MaxTraceThreads)
+        return;
+
+    ThreadTrace* trace = &threadtraces[slot];
+
+    if (index >= 0)
+        snprintf(trace->name, sizeof(trace->name), "%s %d", name, index);
+    else snprintf(trace->name, sizeof(trace->name), "%s", name);
+
+    trace->events = new TraceEvent[capacity];
+    trace->count = 0;
+    trace->dropped = 0;
+
+    currenttrace = trace;
+}
+
+void trace_event(const char* name, const uint64_t begin, const uint64_t end, const int arg)
+{
+    if (currenttrace == nullptr)
+    {
+        trace_register_thread("thread", numthreadtraces.load());
+        if (currenttrace == nullptr)
+            return;
+    }
+
+    ThreadTrace* trace = currenttrace;
+
+    if (trace->count == capacity)
+    {
+        ++trace->dropped;
+        return;
+    }
+
+    TraceEvent& event = trace->events[trace->count++];
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    event.arg = arg;
+}
+
+bool trace_write(const char* filepath)
+{
+    FILE* file = fopen(filepath, "wt");
+    if (file == nullptr)
+        return false;
+
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    const int numthreads = min(numthreadtraces.load(), MaxTraceThreads);
+    bool first = true;
+
+    for (int tid = 0; tid < numthreads; ++tid)
+    {
+        const ThreadTrace& trace = threadtraces[tid];
+
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", tid, trace.name);
+        first = false;
+
+        for (int i = 0; i < trace.count; ++i)
+        {
+            const TraceEvent& event = trace.events[i];
+
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                event.name, tid,
+                ticks_to_us(event.begin - starttime),
+                ticks_to_us(event.end - event.begin));
+
+            if (event.arg >= 0)
+                fprintf(file, ",\"args\":{\"begin\":%d}", event.arg);
+
+            fprintf(file, "}");
+        }
+
+        if (trace.dropped > 0)
+            fprintf(stderr, "Trace buffer of %s overflowed, %d events dropped\n", trace.name, trace.dropped);
+    }
+
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    return fclose(file) == 0;
+}
+
+void trace_stop()
+{
+    traceenabled = false;
+
+    const int numthreads = min(numthreadtraces.load(), MaxTraceThreads);
+    for (int i = 0; i < numthreads; ++i)
+    {
+        delete[] threadtraces[i].events;
+        threadtraces[i].events = nullptr;
+    }
+
+    numthreadtraces.store(0);
+}
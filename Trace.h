@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Profiler.h"
+
+#include <cstdint>
+
+//
+// Per-thread timeline of named events, written as a Chrome trace_event JSON
+// file that can be opened in Perfetto or chrome://tracing. Every thread
+// records into its own buffer, allocated when the thread registers, so
+// recording never locks or allocates. Events past the end of a buffer are
+// dropped.
+//
+
+const int MaxTraceThreads = 64;
+
+extern bool traceenabled;
+
+// Enable tracing with room for the given number of events per thread.
+void trace_start(const int eventsperthread);
+
+// Name the calling thread, with an optional index appended.
+void trace_register_thread(const char* name, const int index = -1);
+
+void trace_event(const char* name, const uint64_t begin, const uint64_t end, const int arg);
+
+// Write all recorded events; threads must have stopped recording.
+bool trace_write(const char* filepath);
+
+void trace_stop();
+
+class TraceScope
+{
+  public:
+    // arg is shown in the trace if it is not negative.
+    explicit TraceScope(const char* name, const int arg = -1)
+      : m_name(name)
+      , m_arg(arg)
+      , m_begin(traceenabled ? profile_now() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (m_begin != 0)
+            trace_event(m_name, m_begin, profile_now(), m_arg);
+    }
+
+  private:
+    const char* m_name;
+    int m_arg;
+    uint64_t m_begin;
+};
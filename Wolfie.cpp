@@ -0,0 +1,623 @@
+#include "Wolfie.h"
+
+#include "Engine.h"
+#include "FrameRing.h"
+#include "RayQuery.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+static_assert(
+    WOLFIE_FORMAT_BGRA8 == static_cast<int>(ObservationBGRA8) &&
+    WOLFIE_FORMAT_GRAY8 == static_cast<int>(ObservationGray8) &&
+    WOLFIE_FORMAT_RED8 == static_cast<int>(ObservationRed8) &&
+    WOLFIE_FORMAT_GREEN8 == static_cast<int>(ObservationGreen8) &&
+    WOLFIE_FORMAT_BLUE8 == static_cast<int>(ObservationBlue8),
+    "formats of the C interface must match ObservationFormat");
+
+static_assert(
+    WOLFIE_CLASS_SKY == static_cast<int>(PixelSky) &&
+    WOLFIE_CLASS_FLOOR == static_cast<int>(PixelFloor) &&
+    WOLFIE_CLASS_WALL == static_cast<int>(PixelWall),
+    "classes of the C interface must match PixelClass");
+
+static_assert(
+    WOLFIE_INPUT_LEFT == static_cast<int>(InputLeft) &&
+    WOLFIE_INPUT_RIGHT == static_cast<int>(InputRight) &&
+    WOLFIE_INPUT_FORWARD == static_cast<int>(InputForward) &&
+    WOLFIE_INPUT_BACKWARD == static_cast<int>(InputBackward) &&
+    WOLFIE_INPUT_RUN == static_cast<int>(InputRun) &&
+    WOLFIE_INPUT_STRAFE == static_cast<int>(InputStrafe) &&
+    WOLFIE_INPUT_RESET == static_cast<int>(InputReset),
+    "input bits of the C interface must match InputBits");
+
+struct WolfieEngine
+{
+    Engine engine;
+    FrameProfile profile;
+};
+
+struct WolfieWorld
+{
+    WolfieEngine* engine;
+    World world;
+    uint32_t input;
+    vector<ScreenPixel> pixels;     // last frame, in the framebuffer layout
+};
+
+struct WolfieSnapshot
+{
+    WorldSnapshot snapshot;
+};
+
+struct WolfieFrameRing
+{
+    FrameRing ring;
+    bool observation;               // frames are observations of desc rather than full frames
+    ObservationDesc desc;
+};
+
+namespace
+{
+    // Rows per tile when copying frames out; a cache line of a column-major frame holds 16 rows.
+    const int CopyTileSize = 16;
+
+    const int MaxSupersampling = 8;
+
+#ifdef FLIP
+    const bool ColumnMajorFrames = true;
+#else
+    const bool ColumnMajorFrames = false;
+#endif
+
+    bool has_textures(const Engine& engine)
+    {
+        if (engine.streamer.is_started())
+            return true;
+
+        for (int i = 0; i < NumTextures; ++i)
+        {
+            if (engine.textures[i].data == nullptr)
+                return false;
+        }
+
+        return true;
+    }
+
+    bool can_render(const Engine& engine, const int pitch)
+    {
+        return pitch >= ScreenWidth * static_cast<int>(sizeof(ScreenPixel)) && has_textures(engine);
+    }
+
+    bool convert_observation(const WolfieObservation& observation, ObservationDesc* desc)
+    {
+        if (observation.width <= 0 ||
+            observation.height <= 0 ||
+            observation.supersampling < 1 ||
+            observation.supersampling > MaxSupersampling ||
+            observation.format < WOLFIE_FORMAT_BGRA8 ||
+            observation.format > WOLFIE_FORMAT_BLUE8)
+            return false;
+
+        desc->width = observation.width;
+        desc->height = observation.height;
+        desc->supersampling = observation.supersampling;
+        desc->format = static_cast<ObservationFormat>(observation.format);
+        desc->maxpool = observation.max_pool != 0;
+
+        return true;
+    }
+
+    bool can_observe(const Engine& engine, const WolfieObservation& observation, ObservationDesc* desc)
+    {
+        return convert_observation(observation, desc) && has_textures(engine);
+    }
+
+    bool convert_buffers(const ObservationDesc& desc, const WolfieObservationBuffers& in, ObservationBuffers* out)
+    {
+        if (in.pixels != nullptr && in.pitch < desc.width * observation_pixel_size(desc.format))
+            return false;
+
+        out->pixels = static_cast<uint8_t*>(in.pixels);
+        out->pitch = in.pitch;
+        out->depth = in.depth;
+        out->classes = in.classes;
+        out->cells = in.cells;
+        out->columndepth = in.column_depth;
+
+        return true;
+    }
+
+    // Whether a ray can start at (x, y): false for NaNs too.
+    bool inside_map(const Map& m, const float x, const float y)
+    {
+        return x >= 0.0f && x < static_cast<float>(m.w) && y >= 0.0f && y < static_cast<float>(m.h);
+    }
+
+    WolfieObservationBuffers pixel_buffers(void* pixels, const int pitch)
+    {
+        WolfieObservationBuffers buffers;
+        memset(&buffers, 0, sizeof(buffers));
+        buffers.pixels = pixels;
+        buffers.pitch = pitch;
+        return buffers;
+    }
+
+    // Copy a frame to a caller's buffer, top row first.
+    void copy_frame(Engine* engine, const ScreenPixel* frame, void* pixels, const int pitch)
+    {
+        uint8_t* out = static_cast<uint8_t*>(pixels);
+
+        engine->pool.parallel_for(ScreenHeight, CopyTileSize, [frame, out, pitch](const int begin, const int end, const int worker)
+        {
+            for (int y = begin; y < end; ++y)
+            {
+                uint8_t* row = out + static_cast<size_t>(y) * pitch;
+#ifdef FLIP
+                for (int x = 0; x < ScreenWidth; ++x)
+                    memcpy(&row[x * sizeof(ScreenPixel)], &frame[x * ScreenHeight + y], sizeof(ScreenPixel));
+#else
+                memcpy(row, &frame[y * ScreenWidth], ScreenWidth * sizeof(ScreenPixel));
+#endif
+            }
+        });
+    }
+}
+
+WolfieEngine* wolfie_create_engine(int numthreads)
+{
+    WolfieEngine* engine = new WolfieEngine();
+    init(&engine->engine);
+    engine->engine.pool.start(max(numthreads, 1));
+    return engine;
+}
+
+WolfieEngine* wolfie_create_engine_from_pack(int numthreads, const char* packpath)
+{
+    WolfieEngine* engine = new WolfieEngine();
+    init(&engine->engine, packpath);
+
+    if (!engine->engine.pack.is_open())
+    {
+        done(&engine->engine);
+        delete engine;
+        return nullptr;
+    }
+
+    engine->engine.pool.start(max(numthreads, 1));
+    return engine;
+}
+
+void wolfie_destroy_engine(WolfieEngine* engine)
+{
+    if (engine == nullptr)
+        return;
+
+    engine->engine.pool.stop();
+    done(&engine->engine);
+    delete engine;
+}
+
+int wolfie_load_texture(WolfieEngine* engine, int index, const char* filepath)
+{
+    if (index < 0 || index >= NumTextures || engine->engine.streamer.is_started())
+        return 0;
+
+    return load_texture(&engine->engine.textures[index], filepath) ? 1 : 0;
+}
+
+void wolfie_stream_textures(WolfieEngine* engine, uint64_t budget)
+{
+    stream_textures(&engine->engine, static_cast<size_t>(budget));
+}
+
+void wolfie_frame_size(int* width, int* height)
+{
+    *width = ScreenWidth;
+    *height = ScreenHeight;
+}
+
+WolfieWorld* wolfie_create_world(WolfieEngine* engine)
+{
+    WolfieWorld* world = new WolfieWorld();
+    world->engine = engine;
+    world->input = 0;
+    return world;
+}
+
+void wolfie_destroy_world(WolfieWorld* world)
+{
+    delete world;
+}
+
+int wolfie_load_map(WolfieWorld* world, int w, int h, const uint8_t* cells)
+{
+    if (w <= 0 || h <= 0)
+        return 0;
+
+    Map m;
+    m.w = w;
+    m.h = h;
+    m.cells.assign(cells, cells + w * h);
+
+    if (!is_valid_map(m))
+        return 0;
+
+    load_map(&world->world, m);
+    reset_player(&world->world);
+
+    return 1;
+}
+
+int wolfie_load_packed_map(WolfieWorld* world, const char* name)
+{
+    if (!load_map(&world->world, world->engine->engine.pack, name))
+        return 0;
+
+    reset_player(&world->world);
+
+    return 1;
+}
+
+void wolfie_set_input(WolfieWorld* world, uint32_t input)
+{
+    world->input = input;
+}
+
+void wolfie_step(WolfieWorld* world, int numticks)
+{
+    step(&world->world, world->input, numticks);
+}
+
+void wolfie_set_tick_rate(WolfieWorld* world, float tickrate)
+{
+    if (tickrate > 0.0f)
+        world->world.tickrate = tickrate;
+}
+
+void wolfie_get_player(const WolfieWorld* world, float* x, float* y, float* a)
+{
+    const Player& player = world->world.player;
+    *x = player.x;
+    *y = player.y;
+    *a = player.a;
+}
+
+void wolfie_set_player(WolfieWorld* world, float x, float y, float a)
+{
+    Player& player = world->world.player;
+    player.x = x;
+    player.y = y;
+    player.a = a;
+    world->world.prevplayer = player;
+}
+
+WolfieSnapshot* wolfie_create_snapshot(const WolfieWorld* world)
+{
+    WolfieSnapshot* snapshot = new WolfieSnapshot();
+    save_snapshot(world->world, &snapshot->snapshot);
+    return snapshot;
+}
+
+void wolfie_destroy_snapshot(WolfieSnapshot* snapshot)
+{
+    delete snapshot;
+}
+
+void wolfie_save_snapshot(const WolfieWorld* world, WolfieSnapshot* snapshot)
+{
+    save_snapshot(world->world, &snapshot->snapshot);
+}
+
+void wolfie_restore_snapshot(WolfieWorld* world, const WolfieSnapshot* snapshot)
+{
+    restore_snapshot(&world->world, snapshot->snapshot);
+}
+
+void wolfie_set_render_flags(WolfieWorld* world, uint32_t flags)
+{
+    world->world.texture = (flags & WOLFIE_RENDER_TEXTURE) != 0;
+    world->world.bilinear = (flags & WOLFIE_RENDER_BILINEAR) != 0;
+    world->world.minimap = (flags & WOLFIE_RENDER_MINIMAP) != 0;
+}
+
+int wolfie_render(WolfieWorld* world, void* pixels, int pitch)
+{
+    Engine* engine = &world->engine->engine;
+    if (!can_render(*engine, pitch))
+        return 0;
+
+    world->pixels.resize(ScreenWidth * ScreenHeight);
+
+    FrameProfile* profile = &world->engine->profile;
+    profile->clear();
+    render(engine, &world->world, capture_frame_state(&world->world, 1.0f), world->pixels.data(), profile);
+
+    copy_frame(engine, world->pixels.data(), pixels, pitch);
+
+    return 1;
+}
+
+int wolfie_step_and_render(
+    WolfieEngine* engine,
+    WolfieWorld* const* worlds,
+    int count,
+    int numticks,
+    void* const* pixels,
+    int pitch)
+{
+    if (!can_render(engine->engine, pitch))
+        return 0;
+
+    vector<BatchItem> items(count);
+    for (int i = 0; i < count; ++i)
+    {
+        worlds[i]->pixels.resize(ScreenWidth * ScreenHeight);
+
+        items[i].world = &worlds[i]->world;
+        items[i].input = worlds[i]->input;
+        items[i].pixels = worlds[i]->pixels.data();
+    }
+
+    engine->profile.clear();
+    step_and_render(&engine->engine, items.data(), count, numticks, &engine->profile);
+
+    for (int i = 0; i < count; ++i)
+        copy_frame(&engine->engine, worlds[i]->pixels.data(), pixels[i], pitch);
+
+    return 1;
+}
+
+int wolfie_observe(WolfieWorld* world, const WolfieObservation* observation, void* pixels, int pitch)
+{
+    const WolfieObservationBuffers buffers = pixel_buffers(pixels, pitch);
+    return wolfie_observe_buffers(world, observation, &buffers);
+}
+
+int wolfie_observe_buffers(WolfieWorld* world, const WolfieObservation* observation, const WolfieObservationBuffers* buffers)
+{
+    Engine* engine = &world->engine->engine;
+
+    ObservationDesc desc;
+    ObservationBuffers out;
+    if (!can_observe(*engine, *observation, &desc) || !convert_buffers(desc, *buffers, &out))
+        return 0;
+
+    FrameProfile* profile = &world->engine->profile;
+    profile->clear();
+    observe(engine, &world->world, capture_frame_state(&world->world, 1.0f), desc, out, profile);
+
+    return 1;
+}
+
+int wolfie_step_and_observe(
+    WolfieEngine* engine,
+    WolfieWorld* const* worlds,
+    int count,
+    int numticks,
+    const WolfieObservation* observation,
+    void* const* pixels,
+    int pitch)
+{
+    vector<WolfieObservationBuffers> buffers(count);
+    for (int i = 0; i < count; ++i)
+        buffers[i] = pixel_buffers(pixels[i], pitch);
+
+    return wolfie_step_and_observe_buffers(engine, worlds, count, numticks, observation, buffers.data());
+}
+
+int wolfie_step_and_observe_buffers(
+    WolfieEngine* engine,
+    WolfieWorld* const* worlds,
+    int count,
+    int numticks,
+    const WolfieObservation* observation,
+    const WolfieObservationBuffers* buffers)
+{
+    ObservationDesc desc;
+    if (!can_observe(engine->engine, *observation, &desc))
+        return 0;
+
+    vector<ObservationItem> items(count);
+    for (int i = 0; i < count; ++i)
+    {
+        if (!convert_buffers(desc, buffers[i], &items[i].buffers))
+            return 0;
+
+        items[i].world = &worlds[i]->world;
+        items[i].input = worlds[i]->input;
+    }
+
+    engine->profile.clear();
+    step_and_observe(&engine->engine, items.data(), count, numticks, desc, &engine->profile);
+
+    return 1;
+}
+
+int wolfie_cast_rays(
+    WolfieWorld* world,
+    int count,
+    const float* x0,
+    const float* y0,
+    const float* x1,
+    const float* y1,
+    uint8_t* hit,
+    float* x,
+    float* y,
+    float* distance,
+    int32_t* cell)
+{
+    if (count > 0 && (x0 == nullptr || y0 == nullptr || x1 == nullptr || y1 == nullptr))
+        return 0;
+
+    const Map& m = world->world.map;
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (!inside_map(m, x0[i], y0[i]) || !isfinite(x1[i]) || !isfinite(y1[i]))
+            return 0;
+    }
+
+    RayBatch rays;
+    rays.count = max(count, 0);
+    rays.x0 = x0;
+    rays.y0 = y0;
+    rays.x1 = x1;
+    rays.y1 = y1;
+
+    RayHits hits;
+    hits.hit = hit;
+    hits.x = x;
+    hits.y = y;
+    hits.distance = distance;
+    hits.cell = cell;
+
+    cast_rays(&world->engine->engine, m, rays, hits);
+
+    return 1;
+}
+
+int wolfie_scan_lidar(
+    WolfieWorld* world,
+    int count,
+    const float* x,
+    const float* y,
+    const float* a,
+    int numbeams,
+    float range,
+    float* distances)
+{
+    if (numbeams <= 0 || !(range > 0.0f) || !isfinite(range))
+        return 0;
+
+    if (count > 0 && (x == nullptr || y == nullptr || a == nullptr || distances == nullptr))
+        return 0;
+
+    const Map& m = world->world.map;
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (!inside_map(m, x[i], y[i]) || !isfinite(a[i]))
+            return 0;
+    }
+
+    LidarPoses poses;
+    poses.count = max(count, 0);
+    poses.x = x;
+    poses.y = y;
+    poses.a = a;
+
+    scan_lidar(&world->engine->engine, m, poses, numbeams, range, distances);
+
+    return 1;
+}
+
+WolfieFrameRing* wolfie_create_frame_ring(const char* name, int numslots, const WolfieObservation* observation)
+{
+    WolfieFrameRing* ring = new WolfieFrameRing();
+    ring->observation = observation != nullptr;
+
+    // Textures are only checked when rendering.
+    const bool created =
+        ring->observation
+            ? convert_observation(*observation, &ring->desc) &&
+              ring->ring.create(name, numslots, ring->desc.width, ring->desc.height, ring->desc.format, false)
+            : ring->ring.create(name, numslots, ScreenWidth, ScreenHeight, ObservationBGRA8, ColumnMajorFrames);
+
+    if (!created)
+    {
+        delete ring;
+        return nullptr;
+    }
+
+    return ring;
+}
+
+WolfieFrameRing* wolfie_open_frame_ring(const char* name)
+{
+    WolfieFrameRing* ring = new WolfieFrameRing();
+    ring->observation = false;
+
+    if (!ring->ring.open(name))
+    {
+        delete ring;
+        return nullptr;
+    }
+
+    return ring;
+}
+
+void wolfie_destroy_frame_ring(WolfieFrameRing* ring)
+{
+    delete ring;
+}
+
+void wolfie_frame_ring_info(const WolfieFrameRing* ring, WolfieFrameRingInfo* info)
+{
+    const FrameRingHeader& header = ring->ring.header();
+    info->numslots = static_cast<int>(header.numslots);
+    info->width = static_cast<int>(header.width);
+    info->height = static_cast<int>(header.height);
+    info->format = static_cast<int>(header.format);
+    info->pitch = static_cast<int>(header.pitch);
+    info->column_major = static_cast<int>(header.columnmajor);
+}
+
+int wolfie_render_to_ring(WolfieWorld* world, WolfieFrameRing* ring)
+{
+    Engine* engine = &world->engine->engine;
+    if (!ring->ring.is_writer() || !has_textures(*engine))
+        return 0;
+
+    FrameProfile* profile = &world->engine->profile;
+    profile->clear();
+
+    const FrameState state = capture_frame_state(&world->world, 1.0f);
+
+    uint8_t* pixels = ring->ring.begin_frame();
+
+    if (ring->observation)
+    {
+        ObservationBuffers buffers;
+        memset(&buffers, 0, sizeof(buffers));
+        buffers.pixels = pixels;
+        buffers.pitch = static_cast<int>(ring->ring.header().pitch);
+        observe(engine, &world->world, state, ring->desc, buffers, profile);
+    }
+    else render(engine, &world->world, state, reinterpret_cast<ScreenPixel*>(pixels), profile);
+
+    ring->ring.end_frame();
+
+    return 1;
+}
+
+void* wolfie_frame_ring_begin(WolfieFrameRing* ring)
+{
+    return ring->ring.is_writer() ? ring->ring.begin_frame() : nullptr;
+}
+
+void wolfie_frame_ring_end(WolfieFrameRing* ring)
+{
+    if (ring->ring.is_writer())
+        ring->ring.end_frame();
+}
+
+uint64_t wolfie_frame_ring_published(const WolfieFrameRing* ring)
+{
+    return ring->ring.published();
+}
+
+const void* wolfie_frame_ring_read(const WolfieFrameRing* ring, uint64_t n)
+{
+    return ring->ring.read_frame(n);
+}
+
+int wolfie_frame_ring_is_intact(const WolfieFrameRing* ring, uint64_t n)
+{
+    return ring->ring.is_intact(n) ? 1 : 0;
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <stdint.h>
+
+//
+// C interface to the engine, for embedding it into programs that have no
+// display. It has no dependency on SDL.
+//
+// An engine holds the textures and the rendering threads shared by all of
+// its worlds. A world holds a map, a player and the render settings, and
+// renders into a buffer provided by the caller. A world must only be used by
+// one thread at a time, and an engine must only render one frame or batch at
+// a time.
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct WolfieEngine WolfieEngine;
+typedef struct WolfieWorld WolfieWorld;
+typedef struct WolfieFrameRing WolfieFrameRing;
+typedef struct WolfieSnapshot WolfieSnapshot;
+
+// Keys held during a tick, same as InputBits.
+enum
+{
+    WOLFIE_INPUT_LEFT       = 1 << 0,
+    WOLFIE_INPUT_RIGHT      = 1 << 1,
+    WOLFIE_INPUT_FORWARD    = 1 << 2,
+    WOLFIE_INPUT_BACKWARD   = 1 << 3,
+    WOLFIE_INPUT_RUN        = 1 << 4,
+    WOLFIE_INPUT_STRAFE     = 1 << 5,
+    WOLFIE_INPUT_RESET      = 1 << 6    // move the player back to the start before the first tick
+};
+
+enum
+{
+    WOLFIE_RENDER_TEXTURE   = 1 << 0,
+    WOLFIE_RENDER_BILINEAR  = 1 << 1,
+    WOLFIE_RENDER_MINIMAP   = 1 << 2
+};
+
+// Pixel formats of observations: 4 bytes per pixel for WOLFIE_FORMAT_BGRA8,
+// 1 for the others.
+enum
+{
+    WOLFIE_FORMAT_BGRA8,
+    WOLFIE_FORMAT_GRAY8,
+    WOLFIE_FORMAT_RED8,
+    WOLFIE_FORMAT_GREEN8,
+    WOLFIE_FORMAT_BLUE8
+};
+
+// View rendered for an agent directly at its own size, with the same
+// horizontal field of view as frames and square pixels. Every pixel averages
+// supersampling rays by supersampling rows, from 1 to 8. With max_pool,
+// stepping more than one tick before observing renders the last two ticks
+// and keeps the maximum of their pixels.
+typedef struct WolfieObservation
+{
+    int width;
+    int height;
+    int supersampling;
+    int format;
+    int max_pool;
+} WolfieObservation;
+
+// What a pixel of an observation shows.
+enum
+{
+    WOLFIE_CLASS_SKY,
+    WOLFIE_CLASS_FLOOR,
+    WOLFIE_CLASS_WALL
+};
+
+// Outputs of an observation, top row first; any of them may be null. Depth
+// is the distance along the view direction, 1e20 for the sky. With
+// supersampling, everything but the colors is taken from the sample at the
+// center of each pixel.
+typedef struct WolfieObservationBuffers
+{
+    void* pixels;
+    int pitch;                  // bytes from a row of pixels to the next
+    float* depth;               // width x height
+    uint8_t* classes;           // width x height WOLFIE_CLASS_* values
+    int32_t* cells;             // width x height, wall cell as iy * map width + ix from the bottom left, -1 for the sky and floor
+    float* column_depth;        // width, distance of the wall seen by every column
+} WolfieObservationBuffers;
+
+// Create an engine rendering with numthreads threads, the calling thread
+// included, and try to load the default textures from the working directory.
+WolfieEngine* wolfie_create_engine(int numthreads);
+
+// Same, reading textures and maps from an asset pack made by WolfiePack
+// instead of from the working directory. Returns null if the pack cannot be
+// opened.
+WolfieEngine* wolfie_create_engine_from_pack(int numthreads, const char* packpath);
+
+void wolfie_destroy_engine(WolfieEngine* engine);
+
+// Load texture index from an image file. Returns 0 on failure, and while
+// textures are streamed.
+int wolfie_load_texture(WolfieEngine* engine, int index, const char* filepath);
+
+// Stop keeping the default textures loaded and load them on demand on a
+// background thread instead, from the pack of the engine if it has one, with
+// at most budget bytes of texels resident; the least recently drawn textures
+// are unloaded first. Rendering never waits for a texture: walls are drawn
+// with its average color, or grey before it was ever loaded, until it is.
+void wolfie_stream_textures(WolfieEngine* engine, uint64_t budget);
+
+// Size of rendered frames in pixels.
+void wolfie_frame_size(int* width, int* height);
+
+// Create a world on the built-in map, with the player at the start.
+WolfieWorld* wolfie_create_world(WolfieEngine* engine);
+void wolfie_destroy_world(WolfieWorld* world);
+
+// Replace the map of a world by w x h cells, top row first, 0 for empty
+// and anything else for a wall, and move the player back to the start. The
+// outermost cells must be walls and the start cell (2, 2) from the bottom
+// left must be empty. Returns 0 if the map is invalid.
+int wolfie_load_map(WolfieWorld* world, int w, int h, const uint8_t* cells);
+
+// Replace the map of a world by the map packed as name in the pack of its
+// engine, such as "maps/default.txt", and move the player back to the start.
+// Returns 0 if there is no such map or it is invalid.
+int wolfie_load_packed_map(WolfieWorld* world, const char* name);
+
+// Set the WOLFIE_INPUT_* keys held during the next steps.
+void wolfie_set_input(WolfieWorld* world, uint32_t input);
+
+// Advance a world by numticks ticks at its tick rate.
+void wolfie_step(WolfieWorld* world, int numticks);
+
+void wolfie_set_tick_rate(WolfieWorld* world, float tickrate);
+
+// Position and heading in radians of the player, with (0,0) at the bottom
+// left of the map.
+void wolfie_get_player(const WolfieWorld* world, float* x, float* y, float* a);
+void wolfie_set_player(WolfieWorld* world, float x, float y, float a);
+
+// Capture the player and the map of a world into a new snapshot, which
+// shares the map as loaded with the world and only stores the cells changed
+// since. Settings and the input are not part of it.
+WolfieSnapshot* wolfie_create_snapshot(const WolfieWorld* world);
+void wolfie_destroy_snapshot(WolfieSnapshot* snapshot);
+
+// Capture a world into an existing snapshot, reusing its memory.
+void wolfie_save_snapshot(const WolfieWorld* world, WolfieSnapshot* snapshot);
+
+// Put a world, the one the snapshot was taken from or any other, back in the
+// state of a snapshot. This is fast once the world is on the same map as
+// loaded; the first restore of a snapshot of another map copies it.
+void wolfie_restore_snapshot(WolfieWorld* world, const WolfieSnapshot* snapshot);
+
+// Set WOLFIE_RENDER_* flags; texturing is on by default.
+void wolfie_set_render_flags(WolfieWorld* world, uint32_t flags);
+
+// Render the current view of a world as BGRA pixels, top row first, with
+// pitch bytes from a row to the next. Returns 0 if the pitch is too small
+// or a texture is missing.
+int wolfie_render(WolfieWorld* world, void* pixels, int pitch);
+
+// Step every world by numticks ticks with its own input, then render them
+// all together; frame i goes to pixels[i]. The worlds must be distinct and
+// belong to the engine. Returns 0 if the pitch is too small or a texture
+// is missing.
+int wolfie_step_and_render(
+    WolfieEngine* engine,
+    WolfieWorld* const* worlds,
+    int count,
+    int numticks,
+    void* const* pixels,
+    int pitch);
+
+// Render an observation of a world on the calling thread, top row first,
+// with pitch bytes from a row to the next. The minimap is never drawn.
+// Returns 0 if the observation or the pitch is invalid or a texture is
+// missing.
+int wolfie_observe(WolfieWorld* world, const WolfieObservation* observation, void* pixels, int pitch);
+
+// Same, with any combination of outputs.
+int wolfie_observe_buffers(WolfieWorld* world, const WolfieObservation* observation, const WolfieObservationBuffers* buffers);
+
+// Step every world by numticks ticks with its own input, then render its
+// observation into pixels[i], spreading the worlds over the threads of the
+// engine. Only the last tick is rendered, or the last two with max_pool, so
+// numticks is the frame skip of an agent repeating its action. Same
+// requirements as wolfie_step_and_render().
+int wolfie_step_and_observe(
+    WolfieEngine* engine,
+    WolfieWorld* const* worlds,
+    int count,
+    int numticks,
+    const WolfieObservation* observation,
+    void* const* pixels,
+    int pitch);
+
+// Same, with the outputs of world i in buffers[i].
+int wolfie_step_and_observe_buffers(
+    WolfieEngine* engine,
+    WolfieWorld* const* worlds,
+    int count,
+    int numticks,
+    const WolfieObservation* observation,
+    const WolfieObservationBuffers* buffers);
+
+// Cast count segments from (x0[i], y0[i]) to (x1[i], y1[i]) against the map
+// of a world, spreading them over the threads of the engine. Rays starting in
+// a wall hit it at their origin. Outputs may be null: hit is 1 if a wall was
+// hit before the end of the segment, x and y the hit point or the end of the
+// segment, distance the distance to that point, and cell the wall cell hit as
+// iy * map width + ix from the bottom left, -1 if none. Returns 0, casting
+// nothing, if an input array is missing, an origin is outside of the map or
+// NaN, or an end is not finite.
+int wolfie_cast_rays(
+    WolfieWorld* world,
+    int count,
+    const float* x0,
+    const float* y0,
+    const float* x1,
+    const float* y1,
+    uint8_t* hit,
+    float* x,
+    float* y,
+    float* distance,
+    int32_t* cell);
+
+// Scan the map of a world with a range sensor at each of count poses,
+// numbeams beams evenly around the heading a[i] counterclockwise starting
+// along it, and write the distance to the first wall hit by each beam, or
+// range if none, to distances[i * numbeams + beam]. Returns 0, scanning
+// nothing, if an input array is missing, numbeams is not positive, range is
+// not positive and finite, or a pose is outside of the map or not finite.
+int wolfie_scan_lidar(
+    WolfieWorld* world,
+    int count,
+    const float* x,
+    const float* y,
+    const float* a,
+    int numbeams,
+    float range,
+    float* distances);
+
+// Layout of the frames of a ring; the shared memory layout and the protocol
+// are described in FrameRing.h.
+typedef struct WolfieFrameRingInfo
+{
+    int numslots;
+    int width;
+    int height;
+    int format;                 // WOLFIE_FORMAT_*
+    int pitch;                  // bytes from a row of pixels to the next, or from a column to the next if column major
+    int column_major;           // 1 for full frames stored left column first, top row first in every column
+} WolfieFrameRingInfo;
+
+// Create a ring of numslots frames in the shared memory object name, for
+// other processes to read them in place. Frames are observations if
+// observation is not null, and full BGRA frames in the layout of the
+// framebuffer otherwise. The name goes away with the ring. Returns null if
+// the observation is invalid or the ring cannot be created.
+WolfieFrameRing* wolfie_create_frame_ring(const char* name, int numslots, const WolfieObservation* observation);
+
+// Open a ring created by another process for reading. Returns null if there
+// is no valid ring of that name.
+WolfieFrameRing* wolfie_open_frame_ring(const char* name);
+
+void wolfie_destroy_frame_ring(WolfieFrameRing* ring);
+
+void wolfie_frame_ring_info(const WolfieFrameRing* ring, WolfieFrameRingInfo* info);
+
+// Render the current view of a world, or its observation, straight into the
+// next slot of a ring created by this process and publish it. Never waits
+// for readers. Returns 0 if the ring was opened for reading or a texture is
+// missing.
+int wolfie_render_to_ring(WolfieWorld* world, WolfieFrameRing* ring);
+
+// Pixels of the next slot of a ring created by this process, to render into
+// some other way, such as a batch of observations with the pitch of the
+// ring, and publish them. Returns null if the ring was opened for reading.
+void* wolfie_frame_ring_begin(WolfieFrameRing* ring);
+void wolfie_frame_ring_end(WolfieFrameRing* ring);
+
+// Number of frames published so far; the last one is published - 1.
+uint64_t wolfie_frame_ring_published(const WolfieFrameRing* ring);
+
+// Pixels of frame n in place, or null if it was not published yet or has
+// been overwritten. Once done reading them, wolfie_frame_ring_is_intact()
+// returns 0 if they were overwritten in the meantime and must be discarded.
+const void* wolfie_frame_ring_read(const WolfieFrameRing* ring, uint64_t n);
+int wolfie_frame_ring_is_intact(const WolfieFrameRing* ring, uint64_t n);
+
+#ifdef __cplusplus
+}
+#endif